@@ -24,57 +24,301 @@
  #include "adc.h"
  #include "stm8s003/adc.h"
  #include "params.h"
+ #include "display.h"
+ #include "power.h"
+ #include "relay.h"
  
  /* ================== Константы и определения ================== */
  
  #define ADC_AVERAGING_BITS      4       // Количество битов для усреднения (2^4=16 значений)
+ #define ADC_OVERSAMPLING_BITS   6       // Накопление 2^6=64 отсчетов на одно прореженное значение
+ #define ADC_EXTRA_BITS          2       // Дополнительные биты разрешения (10 + 2 = 12 бит)
+ #define ADC_DECIMATION_SHIFT    (ADC_OVERSAMPLING_BITS - ADC_EXTRA_BITS)
+ 
+ /*
+  * Адаптивное усреднение: в установившемся режиме используется медленный
+  * фильтр (ADC_AVERAGING_BITS), а при отклонении нового значения от среднего
+  * больше порога - быстрый фильтр с весом 1/2^ADC_FAST_AVERAGING_BITS.
+  * Порог задан в 12-битных отсчетах (около 32 отсчетов на градус при 40..45).
+  */
+ #ifndef ADC_ADAPTIVE_FILTER
+ #define ADC_ADAPTIVE_FILTER     1
+ #endif
+ #ifndef ADC_FAST_AVERAGING_BITS
+ #define ADC_FAST_AVERAGING_BITS 1
+ #endif
+ #ifndef ADC_ADAPTIVE_THRESHOLD
+ #define ADC_ADAPTIVE_THRESHOLD  16
+ #endif
  #define ADC_RAW_TABLE_SIZE      (sizeof(rawAdc) / sizeof(rawAdc[0]))  // Размер таблицы ADC
- #define ADC_RAW_TABLE_BASE_TEMP -520    // Базовое значение температуры (в десятых градуса Цельсия)
- 
- /* 
-  * Таблица соответствия значений АЦП температуре
-  * Диапазон: от -52°C до 112°C (шаг 1°C, всего 165 значений)
-  */
- const unsigned int rawAdc[] = {
-    974, 971, 967, 964, 960, 956, 953, 948, 944, 940,
-    935, 930, 925, 920, 914, 909, 903, 897, 891, 884,
-    877, 871, 864, 856, 849, 841, 833, 825, 817, 809,
-    800, 791, 782, 773, 764, 754, 745, 735, 725, 715,
-    705, 695, 685, 675, 664, 654, 644, 633, 623, 612,
-    601, 591, 580, 570, 559, 549, 538, 528, 518, 507,
-    497, 487, 477, 467, 457, 448, 438, 429, 419, 410,
-    401, 392, 383, 375, 366, 358, 349, 341, 333, 326,
-    318, 310, 303, 296, 289, 282, 275, 269, 262, 256,
-    250, 244, 238, 232, 226, 221, 215, 210, 205, 200,
-    195, 191, 186, 181, 177, 173, 169, 165, 161, 157,
-    153, 149, 146, 142, 139, 136, 132, 129, 126, 123,
-    120, 117, 115, 112, 109, 107, 104, 102, 100, 97,
-    95, 93, 91, 89, 87, 85, 83, 81, 79, 78,
-    76, 74, 73, 71, 69, 68, 67, 65, 64, 62,
-    61, 60, 58, 57, 56, 55, 54, 53, 52, 51,
-    49, 48, 47, 47, 46
- };
+ #define ADC_SEGMENT_MASK        ((1 << ADC_SEGMENT_BITS) - 1)
+ #define ADC_BAND_MASK           ((1 << ADC_BAND_BITS) - 1)
+ #define ADC_BUFFER_SIZE         10      // Количество регистров буфера ADC_DBxR
+ #define ADC_BUFFER_SKIP         2       // Первые отсчеты блока отбрасываются (установление)
+ #define ADC_BLOCK_BITS          3       // Усредняется 2^3=8 оставшихся отсчетов блока
+ 
+ /*
+  * Медианный фильтр сырых отсчетов перед усреднением (3 или 5 отсчетов).
+  * Бюджет: не более 200 тактов на отсчет, т.е. около 2.5% времени ЦП при
+  * 125 отсчетах в секунду на 16 МГц. Сеть из 3 отсчетов укладывается
+  * примерно в 60 тактов, сеть из 5 отсчетов - примерно в 150 тактов.
+  */
+ #ifndef ADC_MEDIAN_TAPS
+ #define ADC_MEDIAN_TAPS         3
+ #endif
+ 
+ #define ADC_WATCHDOG_CONFIRM    3       // Подряд идущих отсчетов вне окна для срабатывания защиты
+ #define ADC_WATCHDOG_RELEASE    64      // Подряд идущих прерываний без отсчетов вне окна для сброса
+ #define ADC_WATCHDOG_HYSTERESIS (10 << ADC_FINE_BITS)   // 1 градус внутрь окна для сброса
+
+ /*
+  * Контроль исправности датчика по отфильтрованным сырым отсчетам.
+  * Рабочий диапазон таблицы 46..974, обрыв датчика дает значения около 1023
+  * (вход подтянут к опорному напряжению), замыкание - около 0. Скачок больше
+  * ADC_SENSOR_SLEW_RAW между соседними отсчетами (около 5 градусов при 40)
+  * физически невозможен и означает плохой контакт.
+  */
+ #define ADC_SENSOR_OPEN_RAW     1000    // Выше - обрыв датчика
+ #define ADC_SENSOR_SHORT_RAW    24      // Ниже - замыкание датчика
+ #define ADC_SENSOR_SLEW_RAW     32      // Допустимое изменение между отсчетами
+ #define ADC_SENSOR_CONFIRM      3       // Подряд идущих ошибочных отсчетов для фиксации
+ 
+ // Обмен значений, если они стоят не по порядку (звено сортирующей сети)
+ #define ADC_SORT(a, b)          if ((a) > (b)) { t = (a); (a) = (b); (b) = t; }
+ 
+ /*
+  * Таблицы преобразования генерируются при сборке программой tools/ntcgen.c
+  * (см. переменные NTC_* в Makefile):
+  *  - rawAdc[] - сырые значения АЦП от ADC_RAW_TABLE_BASE_TEMP с шагом
+  *    ADC_RAW_TABLE_STEP десятых градуса, для обратного преобразования;
+  *  - adcSegmentBase[] / adcSegmentSlope[] - сегменты 12-битного значения:
+  *    температура в начале сегмента (в 1/16 десятой градуса, см. ADC_FINE_BITS)
+  *    и спад температуры на один отсчет в формате Q(ADC_SLOPE_BITS).
+  *    Сегменты шириной 2^ADC_SEGMENT_BITS отсчетов, а внутри рабочей полосы
+  *    ADC_BAND_START..ADC_BAND_END - более узкие, 2^ADC_BAND_BITS отсчетов.
+  */
+ #include "ntc_table.h"
+ 
+ // Значения SPSEL для делителей HSI 0..3 (частота АЦП около 1 МГц)
+ const unsigned char adcPrescaler[] = {0x70, 0x40, 0x20, 0x00};
  
  /* ================== Статические переменные ================== */
  
  static unsigned int result;      // Последнее считанное значение АЦП
- static unsigned long averaged;   // Накопленное значение для усреднения
+ static unsigned long averaged;   // Накопленное значение для усреднения (12 бит)
+ static unsigned int oversampled; // Сумма отсчетов для прореживания
+ static unsigned char oversampledCount;  // Количество накопленных отсчетов
+ static unsigned int window[ADC_MEDIAN_TAPS];  // Кольцевой буфер сырых отсчетов
+ static unsigned char windowPos;  // Позиция записи в кольцевом буфере
+ /* Аналоговый сторожевой таймер (AWD): пороги в сырых отсчетах, пределы
+    в единицах getTemperatureFine() и зафиксированное состояние. */
+ static unsigned int watchdogLow;     // Сырое значение максимальной температуры
+ static unsigned int watchdogHigh;    // Сырое значение минимальной температуры
+ static int watchdogMax;
+ static int watchdogMin;
+ static unsigned char watchdogHits;   // Подряд идущие отсчеты вне окна
+ static unsigned char watchdogClear;  // Подряд идущие прерывания без отсчетов вне окна
+ static unsigned char watchdog;       // ADC_WATCHDOG_NONE / OVER / UNDER
+ /* Контроль датчика: предыдущий отфильтрованный отсчет, счетчик подряд
+    идущих ошибочных отсчетов и зафиксированный код ошибки. */
+ static unsigned int sensorLast;
+ static unsigned char sensorHits;
+ static unsigned char sensorFault;    // ADC_SENSOR_OK / OPEN / SHORT / SLEW
+ static unsigned char pending;        // Запрошен запуск преобразования
+ /* Опубликованная температура и счетчик публикаций. Значение пишется только
+    в ADC1_EOC_handler(), поэтому читатель вне прерывания повторяет чтение,
+    пока счетчик не перестанет меняться (см. getTemperature()). */
+ static volatile int temperature;
+ static volatile unsigned char temperatureSeq;
+ 
+ /* ================== Вспомогательные функции ================== */
+ 
+ /**
+  * @brief Преобразование усредненного значения АЦП в температуру
+  * @note Одно вычисление индекса и одно умножение со сдвигом по таблице
+  *       сегментов, без бинарного поиска и деления. Индекс зависит от того,
+  *       попадает ли значение в рабочую полосу с узкими сегментами.
+  * @return Температура в 1/16 десятой градуса Цельсия с учетом калибровки
+  */
+ static int convertTemperature(void)
+ {
+     unsigned int val = averaged >> ADC_AVERAGING_BITS;  // Текущее усредненное значение (12 бит)
+     unsigned char seg;                                  // Номер сегмента
+     unsigned char offset;                               // Смещение внутри сегмента
+ 
+     if (val < ADC_BAND_START) {
+         seg = val >> ADC_SEGMENT_BITS;
+         offset = val & ADC_SEGMENT_MASK;
+     } else if (val < ADC_BAND_END) {
+         val -= ADC_BAND_START;
+         seg = ADC_BAND_FIRST + (val >> ADC_BAND_BITS);
+         offset = val & ADC_BAND_MASK;
+     } else {
+         val -= ADC_BAND_END;
+         seg = ADC_BAND_AFTER + (val >> ADC_SEGMENT_BITS);
+         offset = val & ADC_SEGMENT_MASK;
+     }
+ 
+     /* Линейная интерполяция внутри сегмента и температурная коррекция */
+     return adcSegmentBase[seg] - ((offset * adcSegmentSlope[seg]) >> ADC_SLOPE_BITS)
+            + (getParamById(PARAM_TEMPERATURE_CORRECTION) << ADC_FINE_BITS);
+ }
+ 
+ /**
+  * @brief Медианный фильтр сырых отсчетов для подавления одиночных выбросов
+  * @param val новый сырой отсчет АЦП
+  * @return Медиана последних ADC_MEDIAN_TAPS отсчетов
+  */
+ static unsigned int filterSample(unsigned int val)
+ {
+     unsigned int a, b, c, t;
+ #if ADC_MEDIAN_TAPS == 5
+     unsigned int d, e;
+ #endif
+ 
+     /* Первый отсчет заполняет весь буфер, чтобы не тянуть медиану к нулю */
+     if (windowPos == 0xFF) {
+         for (windowPos = 0; windowPos < ADC_MEDIAN_TAPS; windowPos++) {
+             window[windowPos] = val;
+         }
+ 
+         windowPos = 0;
+         return val;
+     }
+ 
+     window[windowPos] = val;
+ 
+     if (++windowPos >= ADC_MEDIAN_TAPS) {
+         windowPos = 0;
+     }
+ 
+     a = window[0];
+     b = window[1];
+     c = window[2];
+ #if ADC_MEDIAN_TAPS == 5
+     d = window[3];
+     e = window[4];
+ 
+     /* Сеть из 7 обменов, медиана оказывается в c */
+     ADC_SORT(a, b);
+     ADC_SORT(d, e);
+     ADC_SORT(a, d);
+     ADC_SORT(b, e);
+     ADC_SORT(b, c);
+     ADC_SORT(c, d);
+     ADC_SORT(b, c);
+ 
+     return c;
+ #else
+     /* Сеть из 3 обменов, медиана оказывается в b */
+     ADC_SORT(a, b);
+     ADC_SORT(b, c);
+     ADC_SORT(a, b);
+ 
+     return b;
+ #endif
+ }
+ 
+ /**
+  * @brief Скользящее усреднение прореженных значений
+  * @param sample новое 12-битное значение
+  */
+ static void averageSample(unsigned int sample)
+ {
+ #if ADC_ADAPTIVE_FILTER
+     int innovation;
+ #endif
+ 
+     if (averaged == 0) {
+         averaged = (unsigned long) sample << ADC_AVERAGING_BITS;  // Первое значение
+     } else {
+ #if ADC_ADAPTIVE_FILTER
+         innovation = sample - (unsigned int) (averaged >> ADC_AVERAGING_BITS);
+ 
+         // Быстрое слежение за реальным скачком температуры
+         if (innovation > ADC_ADAPTIVE_THRESHOLD || innovation < -ADC_ADAPTIVE_THRESHOLD) {
+             averaged += (long) innovation * (1 << (ADC_AVERAGING_BITS - ADC_FAST_AVERAGING_BITS));
+         } else {
+             averaged += sample - (averaged >> ADC_AVERAGING_BITS);
+         }
+ #else
+         // Добавление нового значения с учетом веса старых
+         averaged += sample - (averaged >> ADC_AVERAGING_BITS);
+ #endif
+     }
+ }
+ 
+ /**
+  * @brief Обратное преобразование температуры в сырое значение АЦП по rawAdc[]
+  * @note Используется только при настройке порогов, поэтому деление допустимо.
+  * @param temp температура датчика в десятых градуса Цельсия
+  * @return Сырое значение АЦП (0-1023)
+  */
+ static unsigned int temperatureToRaw(int temp)
+ {
+     unsigned int i;
+ 
+     temp -= ADC_RAW_TABLE_BASE_TEMP;
+ 
+     if (temp <= 0) {
+         return rawAdc[0];
+     }
+ 
+     i = temp / ADC_RAW_TABLE_STEP;
+ 
+     if (i >= ADC_RAW_TABLE_SIZE - 1) {
+         return rawAdc[ADC_RAW_TABLE_SIZE - 1];
+     }
+ 
+     /* Линейная интерполяция между соседними значениями таблицы */
+     return rawAdc[i] - ((rawAdc[i] - rawAdc[i + 1]) * (temp % ADC_RAW_TABLE_STEP))
+            / ADC_RAW_TABLE_STEP;
+ }
  
  /* ================== Основные функции ================== */
  
+ /**
+  * @brief Установка предделителя АЦП для частоты ЦП 16 МГц >> shift
+  * @note Частота АЦП поддерживается около 1 МГц: f/18 при 16 МГц (как
+  *       раньше), f/8 при 8 МГц, f/4 при 4 МГц и f/2 при 2 МГц.
+  * @param shift делитель HSI (0..3)
+  */
+ void setAdcClock(unsigned char shift)
+ {
+     ADC_CR1 = (ADC_CR1 & ~0x70) | adcPrescaler[shift];
+ }
+ 
  /**
   * @brief Инициализация АЦП
   * Настраивает предделитель, канал измерения и разрешает прерывания
   */
  void initADC(void)
  {
-     ADC_CR1 |= 0x70;    // Установка предделителя f/18 (SPSEL)
+     setAdcClock(getClockShift());  // Предделитель (SPSEL) для текущей частоты ЦП
      ADC_CSR |= 0x06;    // Выбор канала AIN6
      ADC_CSR |= 0x20;    // Разрешение прерывания по завершению преобразования (EOCIE)
+ #if ADC_BUFFERED_SCAN
+     ADC_CR3 |= 0x80;    // Включение буфера данных (DBUF)
+ #endif
+     ADC_AWCRH = 0x03;   // Сторожевой таймер для всех регистров буфера
+     ADC_AWCRL = 0xFF;
      ADC_CR1 |= 0x01;    // Включение питания АЦП
      
      result = 0;         // Сброс последнего результата
      averaged = 0;       // Сброс накопленного значения
+     oversampled = 0;    // Сброс суммы прореживания
+     oversampledCount = 0;
+     windowPos = 0xFF;   // Буфер медианного фильтра еще не заполнен
+     temperature = convertTemperature();  // До первого измерения - верхний предел таблицы
+     temperatureSeq = 0;
+     watchdogHits = 0;
+     watchdogClear = 0;
+     watchdog = ADC_WATCHDOG_NONE;
+     sensorLast = 0;
+     sensorHits = 0;
+     sensorFault = ADC_SENSOR_OK;
+     pending = 0;
+     updateAdcWatchdog();   // Пороги защиты из параметров
  }
  
  /**
@@ -82,7 +326,59 @@
   */
  void startADC(void)
  {
+ #if ADC_BUFFERED_SCAN
+     ADC_CR1 |= 0x03;    // Непрерывный режим (CONT) и запуск преобразования
+ #else
      ADC_CR1 |= 0x01;    // Установка бита запуска преобразования
+ #endif
+ }
+ 
+ /**
+  * @brief Отключение питания АЦП перед переходом в режим пониженного потребления
+  */
+ void suspendADC(void)
+ {
+     ADC_CR1 &= ~0x03;   // Остановка непрерывного режима и отключение питания (ADON)
+     pending = 0;
+ }
+ 
+ /**
+  * @brief Включение питания АЦП после выхода из режима пониженного потребления
+  * @note Первая запись ADON только включает АЦП, преобразование запустит
+  *       следующий вызов startADC(). Состояние фильтров сохраняется.
+  */
+ void resumeADC(void)
+ {
+     ADC_CR1 |= 0x01;    // Включение питания АЦП
+ }
+ 
+ /**
+  * @brief Запрос преобразования АЦП
+  * @note Само преобразование запускается из refreshDisplay() в интервале,
+  *       когда все разряды индикатора погашены (см. startPendingADC()).
+  */
+ void requestADC(void)
+ {
+     pending = 1;
+ }
+ 
+ /**
+  * @brief Запуск запрошенного преобразования АЦП
+  * @note Вызывается из прерывания таймера при погашенных разрядах. Разряд
+  *       остается погашенным до прерывания АЦП: около 16 мкс на одно
+  *       преобразование (около 1 МГц, 14 тактов АЦП) или около 160 мкс на блок
+  *       буфера, т.е. меньше 1% периода мультиплексирования 2 мс.
+  * @return 1 - преобразование запущено, 0 - запроса не было
+  */
+ unsigned char startPendingADC(void)
+ {
+     if (!pending) {
+         return 0;
+     }
+ 
+     pending = 0;
+     startADC();
+     return 1;
  }
  
  /**
@@ -96,44 +392,115 @@
  
  /**
   * @brief Получение усредненного значения АЦП
-  * @return Усредненное значение (16 последних измерений)
+  * @return Усредненное значение (16 последних прореженных измерений), 10 бит
   */
  unsigned int getAdcAveraged(void)
  {
-     return (unsigned int)(averaged >> ADC_AVERAGING_BITS);
+     return (unsigned int)(averaged >> (ADC_AVERAGING_BITS + ADC_EXTRA_BITS));
  }
  
  /**
-  * @brief Расчет температуры на основе усредненного значения АЦП
+  * @brief Получение температуры, рассчитанной по последнему измерению
+  * @note Значение пересчитывается один раз на каждое новое измерение
+  *       в ADC1_EOC_handler(), поэтому вызов почти ничего не стоит.
   * @return Температура в десятых градуса Цельсия с учетом калибровки
   */
  int getTemperature(void)
  {
-     unsigned int val = averaged >> ADC_AVERAGING_BITS;  // Текущее усредненное значение
-     unsigned char rightBound = ADC_RAW_TABLE_SIZE;      // Правая граница поиска
-     unsigned char leftBound = 0;                        // Левая граница поиска
+     return getTemperatureFine() >> ADC_FINE_BITS;
+ }
  
-     /* Бинарный поиск в таблице соответствия */
-     while ((rightBound - leftBound) > 1) {
-         unsigned char midId = (leftBound + rightBound) >> 1;
+ /**
+  * @brief Получение температуры с повышенным разрешением
+  * @note Разрешение 12-битного тракта около 0.03 градуса в диапазоне
+  *       40..45 градусов.
+  * @return Температура в 1/16 десятой градуса Цельсия с учетом калибровки
+  */
+ int getTemperatureFine(void)
+ {
+     unsigned char seq;
+     int val;
  
-         if (val > rawAdc[midId]) {
-             rightBound = midId;
-         } else {
-             leftBound = midId;
-         }
-     }
+     /* Повтор чтения, если его прервала публикация нового значения */
+     do {
+         seq = temperatureSeq;
+         val = temperature;
+     } while (seq != temperatureSeq);
  
-     /* Линейная интерполяция между ближайшими значениями */
-     if (val >= rawAdc[leftBound]) {
-         val = leftBound * 10;
-     } else {
-         val = (rightBound * 10) - ((val - rawAdc[rightBound]) * 10) / 
-               (rawAdc[leftBound] - rawAdc[rightBound]);
+     return val;
+ }
+ 
+ /**
+  * @brief Получение счетчика публикаций температуры
+  * @return Значение, которое изменяется при каждом новом измерении
+  */
+ unsigned char getTemperatureSeq(void)
+ {
+     return temperatureSeq;
+ }
+ 
+ /**
+  * @brief Пересчет порогов аналогового сторожевого таймера по параметрам
+  *        максимальной и минимальной температуры
+  * @note Параметры заданы в целых градусах показываемой температуры, поэтому
+  *       перед переводом в сырые отсчеты из них вычитается калибровка.
+  *       Высокая температура дает низкое значение АЦП, поэтому максимум
+  *       программируется в нижний порог (LTR), а минимум - в верхний (HTR).
+  *       Вызывается из главного цикла, поэтому на время смены порогов
+  *       прерывание АЦП запрещается: обработчик читает их 16-битными.
+  */
+ void updateAdcWatchdog(void)
+ {
+     int maxTemp = getParamById(PARAM_MAX_TEMPERATURE) * 10;
+     int minTemp = getParamById(PARAM_MIN_TEMPERATURE) * 10;
+     int correction = getParamById(PARAM_TEMPERATURE_CORRECTION);
+ 
+     ADC_CSR &= ~0x20;   // Запрет прерывания АЦП (EOCIE)
+     watchdogMax = maxTemp << ADC_FINE_BITS;
+     watchdogMin = minTemp << ADC_FINE_BITS;
+     watchdogLow = temperatureToRaw(maxTemp - correction);
+     watchdogHigh = temperatureToRaw(minTemp - correction);
+ 
+     /* Минимум не ниже максимума - контроль снизу отключается */
+     if (watchdogHigh <= watchdogLow) {
+         watchdogHigh = 0x3FF;
+         watchdogMin = -0x7FFF;
      }
  
-     /* Применение температурной коррекции */
-     return ADC_RAW_TABLE_BASE_TEMP + val + getParamById(PARAM_TEMPERATURE_CORRECTION);
+     ADC_LTRH = watchdogLow >> 2;    // Старшие 8 бит нижнего порога
+     ADC_LTRL = watchdogLow & 0x03;  // Младшие 2 бита
+     ADC_HTRH = watchdogHigh >> 2;   // Старшие 8 бит верхнего порога
+     ADC_HTRL = watchdogHigh & 0x03; // Младшие 2 бита
+     ADC_CSR |= 0x20;    // Разрешение прерывания АЦП, отложенный EOC будет обработан
+ }
+ 
+ /**
+  * @brief Получение состояния аналогового сторожевого таймера
+  * @return ADC_WATCHDOG_NONE, ADC_WATCHDOG_OVER или ADC_WATCHDOG_UNDER
+  */
+ unsigned char getAdcWatchdog(void)
+ {
+     return watchdog;
+ }
+ 
+ /**
+  * @brief Получение зафиксированной ошибки датчика
+  * @return ADC_SENSOR_OK, ADC_SENSOR_OPEN, ADC_SENSOR_SHORT или ADC_SENSOR_SLEW
+  */
+ unsigned char getSensorFault(void)
+ {
+     return sensorFault;
+ }
+ 
+ /**
+  * @brief Сброс зафиксированной ошибки датчика (подтверждение пользователем)
+  * @note Если неисправность не устранена, ошибка фиксируется снова через
+  *       ADC_SENSOR_CONFIRM отсчетов.
+  */
+ void clearSensorFault(void)
+ {
+     sensorHits = 0;
+     sensorFault = ADC_SENSOR_OK;
  }
  
  /**
@@ -141,16 +508,126 @@
   */
  void ADC1_EOC_handler(void) __interrupt(22)
  {
+     unsigned int sample;
+     unsigned int filtered;
+     unsigned char fault;
+ #if ADC_BUFFERED_SCAN
+     unsigned char i;
+     unsigned int sum = 0;
+     unsigned int flags;
+ 
+     ADC_CR1 &= ~0x02;           // Остановка непрерывного режима после заполнения буфера
+ 
+     /* Усреднение блока отсчетов из буфера (по 10 бит, старший байт первым) */
+     for (i = ADC_BUFFER_SKIP; i < ADC_BUFFER_SIZE; i++) {
+         sum += filterSample((ADC_DBxR[i << 1] << 2) | ADC_DBxR[(i << 1) + 1]);
+     }
+ 
+     result = sum >> ADC_BLOCK_BITS;
+     filtered = result;
+     oversampled += sum;
+     oversampledCount += 1 << ADC_BLOCK_BITS;
+     ADC_CR3 &= ~0x40;           // Сброс флага переполнения буфера (OVR)
+ 
+     /* Подсчет отсчетов блока, вышедших за окно сторожевого таймера */
+     flags = (ADC_AWSRH << 8) | ADC_AWSRL;
+     ADC_AWSRH = 0;
+     ADC_AWSRL = 0;
+ 
+     if (flags == 0) {
+         watchdogHits = 0;
+     }
+ 
+     for (; flags != 0; flags >>= 1) {
+         watchdogHits += flags & 0x01;
+     }
+ #else
      /* Чтение результата преобразования (10-битное значение) */
      result = ADC_DRH << 2;      // Старшие 8 бит
      result |= ADC_DRL;          // Младшие 2 бита
-     ADC_CSR &= ~0x80;           // Сброс флага завершения преобразования (EOC)
+     filtered = filterSample(result);
+     oversampled += filtered;
+     oversampledCount++;
  
-     /* Скользящее усреднение результатов */
-     if (averaged == 0) {
-         averaged = result << ADC_AVERAGING_BITS;  // Первое значение
+     /* Отсчет вне окна сторожевого таймера */
+     if (ADC_CSR & 0x40) {
+         watchdogHits++;
      } else {
-         // Добавление нового значения с учетом веса старых
-         averaged += result - (averaged >> ADC_AVERAGING_BITS);
+         watchdogHits = 0;
+     }
+ #endif
+     ADC_CSR &= ~0xC0;           // Сброс флагов завершения преобразования (EOC) и AWD
+     resumeDisplay();            // Преобразование завершено, индикатор можно зажечь
+ 
+     /* Контроль датчика: модуль скачка сравнивается одним беззнаковым сравнением */
+     if (filtered > ADC_SENSOR_OPEN_RAW) {
+         fault = ADC_SENSOR_OPEN;
+     } else if (filtered < ADC_SENSOR_SHORT_RAW) {
+         fault = ADC_SENSOR_SHORT;
+     } else if ((unsigned int) (filtered - sensorLast + ADC_SENSOR_SLEW_RAW) > 2 * ADC_SENSOR_SLEW_RAW) {
+         fault = ADC_SENSOR_SLEW;
+     } else {
+         fault = ADC_SENSOR_OK;
+     }
+ 
+     sensorLast = filtered;
+ 
+     if (fault == ADC_SENSOR_OK) {
+         sensorHits = 0;
+     } else if (++sensorHits >= ADC_SENSOR_CONFIRM) {
+         sensorHits = ADC_SENSOR_CONFIRM;
+ 
+         // Фиксируется первая ошибка, реле отключается в этом же прерывании
+         if (sensorFault == ADC_SENSOR_OK) {
+             sensorFault = fault;
+         }
+ 
+         forceRelayOff();
+     }
+ 
+     if (watchdogHits == 0) {
+         if (watchdogClear < ADC_WATCHDOG_RELEASE) {
+             watchdogClear++;
+         }
+     } else {
+         watchdogClear = 0;
+     }
+ 
+     /* Аппаратная защита: реле отключается в этом же прерывании */
+     if (watchdogHits >= ADC_WATCHDOG_CONFIRM) {
+         watchdogHits = ADC_WATCHDOG_CONFIRM;
+ 
+         if (result < watchdogLow) {
+             watchdog = ADC_WATCHDOG_OVER;
+             forceRelayOff();
+         } else if (result > watchdogHigh) {
+             watchdog = ADC_WATCHDOG_UNDER;
+         }
+     }
+ 
+     /* Накопление отсчетов до полного блока передискретизации */
+     if (oversampledCount < (1 << ADC_OVERSAMPLING_BITS)) {
+         return;
+     }
+ 
+     /* Прореживание: 64 отсчета по 10 бит дают одно 12-битное значение */
+     sample = oversampled >> ADC_DECIMATION_SHIFT;
+     oversampled = 0;
+     oversampledCount = 0;
+     averageSample(sample);
+ 
+     /* Однократный пересчет и публикация температуры */
+     temperature = convertTemperature();
+     temperatureSeq++;
+ 
+     /* Сброс защиты, когда отфильтрованная температура вернулась в окно с
+        запасом ADC_WATCHDOG_HYSTERESIS, а сырые отсчеты не выходят за окно
+        ADC_WATCHDOG_RELEASE прерываний подряд. Иначе запаздывающее среднее
+        снимало бы защиту при отсчетах еще за порогом и реле дребезжало бы
+        на границе. */
+     if (watchdogClear >= ADC_WATCHDOG_RELEASE
+             && temperature <= watchdogMax - ADC_WATCHDOG_HYSTERESIS
+             && temperature >= watchdogMin + ADC_WATCHDOG_HYSTERESIS) {
+         watchdog = ADC_WATCHDOG_NONE;
      }
  }
@@ -23,6 +23,7 @@
  #include "buttons.h"
  #include "stm8s003/gpio.h"
  #include "menu.h"
+ #include "events.h"
  
  /* ================ Определения для работы с кнопками ================ */
  
@@ -145,7 +146,7 @@
  
  /**
   * @brief Обработчик прерывания от кнопок
-  * Определяет какая кнопка была нажата/отпущена и отправляет событие в меню
+  * Определяет какая кнопка была нажата/отпущена и ставит событие меню в очередь
   */
  void EXTI2_handler(void) __interrupt(5)
  {
@@ -170,6 +171,6 @@
          return;  // Если прерывание вызвано не кнопками - выходим
      }
  
-     // Передача события в систему меню
-     feedMenu(event);
+     // Передача события в меню, обработка выполняется в main()
+     postEvent(event);
  }
@@ -0,0 +1,200 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Calibration of the HSI clock which runs the timers.
+ * The untrimmed HSI is accurate to about 1% at room temperature, which is
+ * several minutes over a long fermentation. The error is measured against
+ * a reference clock and corrected in two steps: coarse steps of the HSI
+ * trimming register (CLK_HSITRIMR) and the digital correction of the tick
+ * count with 1 ppm resolution (see setTimerCorrection()).
+ *
+ * There is no reference input on the board, so the reference edges are
+ * given with button 2 against a reliable clock:
+ *  1. Long press of buttons 2 and 3 at the root menu starts the procedure,
+ *     "CAL" is shown and the digital correction is disabled.
+ *  2. Button 2 is pressed when the reference clock passes a minute mark,
+ *     "C.A.L." is shown while measuring.
+ *  3. Button 2 is pressed again on the same mark a whole number of hours
+ *     later (up to CALIBRATION_MAX_HOURS). The interval is rounded to whole
+ *     hours, so the error of the untrimmed HSI may be up to a few percent.
+ * Long press of button 3 cancels the measurement. The uncertainty of a
+ * press is about 0.1 s, so a one hour interval gives about 50 ppm, or two
+ * seconds over a 10 hour batch; longer intervals are more accurate.
+ *
+ * An error above CALIBRATION_TRIM_PPM steps the HSI trimming by one and
+ * clears the digital correction. The size of the step is not known
+ * exactly, so the measurement has to be repeated in this case.
+ *
+ * Record layout in EEPROM (CALIBRATION_SIZE bytes):
+ * |--Trim--|--Correction (ppm, 16 bits)--|--Check--|
+ * 0        1                             3
+ * Check is the complement of the sum of other bytes, an erased record is
+ * not valid and leaves the factory trimming.
+ */
+
+#include "calibration.h"
+#include "stm8s003/clock.h"
+#include "params.h"
+#include "timer.h"
+
+#define CALIBRATION_SIZE        4
+#define CALIBRATION_MAX_HOURS   8
+#define CALIBRATION_TRIM_PPM    10000   // Larger errors are trimmed by the HSI
+#define CALIBRATION_MAX_PPM     20000   // Limit of the digital correction
+#define CALIBRATION_TRIM_MIN    -8      // HSITRIM is a signed 4-bit value
+#define CALIBRATION_TRIM_MAX    7
+#define TICKS_IN_HOUR           (3600UL * TICKS_IN_SECOND)
+#define RECORD_BYTE(offset)     EEPROM_BYTE (EEPROM_CALIBRATION_OFFSET + (offset) )
+
+static unsigned char state;
+static signed char trim;
+static int correction;
+static unsigned long startSeconds;
+static unsigned int startTicks;
+
+/**
+ * @brief Applies the trimming and the correction to the clock.
+ */
+static void applyCalibration()
+{
+    CLK_HSITRIMR = trim & 0x0F;
+    setTimerCorrection (correction);
+}
+
+/**
+ * @brief Loads the calibration from EEPROM and applies it. Called from
+ *  initTimer().
+ */
+void initCalibration()
+{
+    unsigned char record[CALIBRATION_SIZE], i;
+
+    for (i = 0; i < CALIBRATION_SIZE; i++) {
+        record[i] = RECORD_BYTE (i);
+    }
+
+    state = CALIBRATION_OFF;
+    trim = 0;
+    correction = 0;
+
+    if (record[CALIBRATION_SIZE - 1] == checkRecord (record, CALIBRATION_SIZE) ) {
+        trim = record[0];
+        correction = (signed char) record[1] * 256 + record[2];
+    }
+
+    applyCalibration();
+}
+
+/**
+ * @brief Stores the calibration into EEPROM, changed bytes only.
+ */
+static void storeCalibration()
+{
+    static unsigned char record[CALIBRATION_SIZE];
+
+    record[0] = trim;
+    record[1] = (unsigned int) correction >> 8;
+    record[2] = correction;
+    record[3] = checkRecord (record, CALIBRATION_SIZE);
+    storeRecord (EEPROM_CALIBRATION_OFFSET, record, CALIBRATION_SIZE);
+}
+
+/**
+ * @brief Starts the calibration procedure. The digital correction is
+ *  disabled until the procedure is finished.
+ */
+void startCalibration()
+{
+    state = CALIBRATION_READY;
+    setTimerCorrection (0);
+}
+
+/**
+ * @brief Cancels the calibration procedure and restores the correction.
+ */
+void cancelCalibration()
+{
+    state = CALIBRATION_OFF;
+    applyCalibration();
+}
+
+/**
+ * @brief Marks the start or the end of the reference interval. At the end
+ *  the error of the clock is calculated, applied and stored into EEPROM.
+ */
+void markCalibration()
+{
+    TimeSnapshot now;
+    unsigned long elapsed, hours;
+    long error;
+
+    getTimeSnapshot (&now);
+
+    if (state == CALIBRATION_READY) {
+        startSeconds = now.uptime;
+        startTicks = now.ticks;
+        state = CALIBRATION_RUNNING;
+        return;
+    }
+
+    if (state != CALIBRATION_RUNNING) {
+        return;
+    }
+
+    state = CALIBRATION_OFF;
+    elapsed = (now.uptime - startSeconds) * TICKS_IN_SECOND + now.ticks - startTicks;
+    hours = (elapsed + TICKS_IN_HOUR / 2) / TICKS_IN_HOUR;
+
+    if (hours == 0 || hours > CALIBRATION_MAX_HOURS) {
+        applyCalibration();
+        return;
+    }
+
+    // Error in ppm: 1000000 / TICKS_IN_HOUR is 5 / 9. Positive when fast.
+    error = (long) (elapsed - hours * TICKS_IN_HOUR) * 5 / (long) (hours * 9);
+
+    if (error > CALIBRATION_TRIM_PPM && trim > CALIBRATION_TRIM_MIN) {
+        trim--;
+        correction = 0;
+    } else if (error < -CALIBRATION_TRIM_PPM && trim < CALIBRATION_TRIM_MAX) {
+        trim++;
+        correction = 0;
+    } else {
+        // Out of the trimming range, correct as much as possible.
+        if (error > CALIBRATION_MAX_PPM) {
+            error = CALIBRATION_MAX_PPM;
+        } else if (error < -CALIBRATION_MAX_PPM) {
+            error = -CALIBRATION_MAX_PPM;
+        }
+
+        correction = error;
+    }
+
+    applyCalibration();
+    storeCalibration();
+}
+
+/**
+ * @brief Gets the state of the calibration procedure.
+ * @return CALIBRATION_OFF, CALIBRATION_READY (waiting for the start mark)
+ *  or CALIBRATION_RUNNING (waiting for the end mark).
+ */
+unsigned char getCalibrationState()
+{
+    return state;
+}
@@ -0,0 +1,196 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * Checkpoints of the batch state in the data EEPROM.
+ * The thermostat state, the fermentation timer and the step of the
+ * fermentation profile are saved so that an interrupted batch is resumed
+ * after a power loss. A record is written when the state changes and every
+ * CHECKPOINT_PERIOD seconds while the timer is counting down or the profile
+ * is running, so at most this much fermentation time is repeated after a
+ * power loss.
+ *
+ * Records rotate over CHECKPOINT_SLOTS slots to spread the wear: with a
+ * 10 minute period each slot is written every 30 minutes, which gives more
+ * than five years of continuous operation for 100k write cycles.
+ *
+ * Record layout (CHECKPOINT_SIZE bytes):
+ * |--Seq--|--Flags--|--Remaining (24 bits)--|--Hold (16 bits)--|--Check--|
+ * 0       1         2                       5                  7
+ * Flags hold the profile step in the upper bits, Hold is the remaining hold
+ * time of the step in minutes while soaking.
+ * Check is the complement of the sum of other bytes, so an erased or
+ * partially written slot is not valid. The valid slot with the newest
+ * sequence number is the current one.
+ *
+ * The record is written by storeRecord(), one byte per main loop pass.
+ */
+
+#include "checkpoint.h"
+#include "params.h"
+#include "profile.h"
+#include "relay.h"
+#include "timer.h"
+
+#define CHECKPOINT_SLOTS        3
+#define CHECKPOINT_SIZE         8
+#define CHECKPOINT_PERIOD       600     // Seconds between records of a running batch
+#define CHECKPOINT_RELAY        0x01    // Thermostat is enabled
+#define CHECKPOINT_TIMER        0x02    // Fermentation timer is active
+#define CHECKPOINT_PAUSED       0x04    // Fermentation timer is paused
+#define CHECKPOINT_PROFILE      0x08    // Fermentation profile is running
+#define CHECKPOINT_SOAKING      0x10    // Hold time of the step is counting
+#define CHECKPOINT_STEP_SHIFT   5       // Profile step in bits 5 ... 7
+#define SLOT_BYTE(offset)       EEPROM_BYTE (EEPROM_CHECKPOINT_OFFSET + (offset) )
+
+static unsigned char record[CHECKPOINT_SIZE];
+static unsigned char slot;
+static unsigned char lastFlags;
+static unsigned long lastTime;
+
+/**
+ * @brief Gets flags of the current state.
+ */
+static unsigned char getStateFlags()
+{
+    unsigned char flags = 0;
+
+    if (isRelayEnabled() ) {
+        flags |= CHECKPOINT_RELAY;
+    }
+
+    if (isFTimer() ) {
+        flags |= CHECKPOINT_TIMER;
+
+        if (isFTimerPaused() ) {
+            flags |= CHECKPOINT_PAUSED;
+        }
+    }
+
+    if (isProfile() ) {
+        flags |= CHECKPOINT_PROFILE | (getProfileStep() << CHECKPOINT_STEP_SHIFT);
+
+        if (getProfileRemaining() != PROFILE_NOT_SOAKING) {
+            flags |= CHECKPOINT_SOAKING;
+        }
+    }
+
+    return flags;
+}
+
+/**
+ * @brief Finds the newest valid record and resumes the state saved there.
+ *  Must be called after the relay and timer are initialized.
+ */
+void initCheckpoint()
+{
+    unsigned char i, j, found = CHECKPOINT_SLOTS;
+    unsigned long remaining;
+
+    for (i = 0; i < CHECKPOINT_SLOTS; i++) {
+        for (j = 0; j < CHECKPOINT_SIZE; j++) {
+            record[j] = SLOT_BYTE (i * CHECKPOINT_SIZE + j);
+        }
+
+        if (record[CHECKPOINT_SIZE - 1] != checkRecord (record, CHECKPOINT_SIZE) ) {
+            continue;
+        }
+
+        // Sequence numbers wrap around, compare the distance.
+        if (found == CHECKPOINT_SLOTS
+                || (signed char) (record[0] - SLOT_BYTE (found * CHECKPOINT_SIZE) ) > 0) {
+            found = i;
+        }
+    }
+
+    lastTime = 0;
+
+    if (found == CHECKPOINT_SLOTS) {
+        slot = CHECKPOINT_SLOTS - 1;
+        record[0] = 0xFF;
+        lastFlags = getStateFlags();
+        return;
+    }
+
+    slot = found;
+
+    for (j = 0; j < CHECKPOINT_SIZE; j++) {
+        record[j] = SLOT_BYTE (slot * CHECKPOINT_SIZE + j);
+    }
+
+    lastFlags = record[1];
+
+    if (lastFlags & CHECKPOINT_TIMER) {
+        remaining = ( (unsigned long) record[2] << 16) | ( (unsigned int) record[3] << 8) | record[4];
+        resumeFTimer (remaining, lastFlags & CHECKPOINT_PAUSED);
+    }
+
+    if (lastFlags & CHECKPOINT_PROFILE) {
+        resumeProfile (lastFlags >> CHECKPOINT_STEP_SHIFT, (lastFlags & CHECKPOINT_SOAKING)
+                       ? (record[5] << 8) | record[6] : PROFILE_NOT_SOAKING);
+    }
+
+    enableRelay (lastFlags & CHECKPOINT_RELAY);
+}
+
+/**
+ * @brief Writes a checkpoint when the state has changed or the period has
+ *  passed. Called on every pass of the main loop.
+ */
+void refreshCheckpoint()
+{
+    unsigned char flags;
+    unsigned int hold;
+    unsigned long remaining, now;
+
+    // The previous record is still being written.
+    if (!isRecordStored() ) {
+        return;
+    }
+
+    flags = getStateFlags();
+    now = getUptime();
+
+    if (flags == lastFlags && (flags & CHECKPOINT_PROFILE) == 0
+            && (flags & (CHECKPOINT_TIMER | CHECKPOINT_PAUSED) ) != CHECKPOINT_TIMER) {
+        return;
+    }
+
+    if (flags == lastFlags && now - lastTime < CHECKPOINT_PERIOD) {
+        return;
+    }
+
+    remaining = getFTimerRemaining();
+    hold = getProfileRemaining();
+    record[0]++;
+    record[1] = flags;
+    record[2] = (unsigned char) (remaining >> 16);
+    record[3] = (unsigned char) (remaining >> 8);
+    record[4] = (unsigned char) remaining;
+    record[5] = hold >> 8;
+    record[6] = hold;
+    record[CHECKPOINT_SIZE - 1] = checkRecord (record, CHECKPOINT_SIZE);
+
+    if (++slot >= CHECKPOINT_SLOTS) {
+        slot = 0;
+    }
+
+    storeRecord (EEPROM_CHECKPOINT_OFFSET + slot * CHECKPOINT_SIZE, record, CHECKPOINT_SIZE);
+    lastFlags = flags;
+    lastTime = now;
+}
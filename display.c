@@ -21,6 +21,7 @@
 
  #include "display.h"
  #include "stm8s003/gpio.h"
+ #include "adc.h"
  
  /* Определения для работы с дисплеем */
  // Порт A управляет сегментами: B, F
@@ -68,11 +69,13 @@
  
  // Прототипы статических функций
  static void enableDigit(unsigned char id);
+ static void lightDigit(void);
  static void setDigit(unsigned char id, unsigned char val, bool dot);
  
  // Флаги состояния дисплея
  static bool displayOff;  // Состояние вкл/выкл дисплея
  static bool testMode;    // Режим тестирования дисплея
+ static bool blanked;     // Разряды погашены на время преобразования АЦП
  
  /**
   * @brief Инициализация дисплея - настройка GPIO и начальных параметров
@@ -93,6 +96,7 @@
      
      // Инициализация состояния дисплея
      displayOff = false;
+     blanked = false;
      activeDigitId = 0;
      setDisplayTestMode(true, "");
  }
@@ -101,16 +105,50 @@
   * @brief Обновление состояния дисплея (вызывается из прерывания таймера)
   * @note Должна быть максимально быстрой, так как вызывается в прерывании.
   *       Использует данные из буфера дисплея для управления GPIO.
+  *       Запрошенное преобразование АЦП запускается, пока все разряды
+  *       погашены, чтобы ток светодиодов не наводил помеху на датчик.
+  *       Разряд в этом случае зажигается из прерывания АЦП (resumeDisplay()).
   */
  void refreshDisplay(void)
  {
      // Сначала отключаем все разряды
      enableDigit(3);
  
+     blanked = startPendingADC();
+ 
+     if (blanked) {
+         return;
+     }
+ 
      if (displayOff) {
          return;
      }
  
+     lightDigit();
+ }
+ 
+ /**
+  * @brief Зажигание разряда, отложенного на время преобразования АЦП
+  * @note Вызывается из прерывания АЦП по завершению преобразования.
+  */
+ void resumeDisplay(void)
+ {
+     if (!blanked) {
+         return;
+     }
+ 
+     blanked = false;
+ 
+     if (!displayOff) {
+         lightDigit();
+     }
+ }
+ 
+ /**
+  * @brief Вывод текущего разряда и переход к следующему
+  */
+ static void lightDigit(void)
+ {
      // Обновляем состояние сегментов из буферов
      SSD_SEG_BF_PORT &= ~SSD_BF_PORT_MASK;
      SSD_SEG_BF_PORT |= displayAC[activeDigitId] & SSD_BF_PORT_MASK;
@@ -421,6 +459,11 @@
          displayD[id] = SSD_SEG_A_BIT | SSD_SEG_E_BIT;
          break;
  
+     case 'S':
+         displayAC[id] = SSD_SEG_C_BIT | SSD_SEG_F_BIT | SSD_SEG_G_BIT;
+         displayD[id] = SSD_SEG_A_BIT | SSD_SEG_D_BIT;
+         break;
+ 
      case 'T':
          displayAC[id] = SSD_SEG_F_BIT | SSD_SEG_G_BIT;
          displayD[id] = SSD_SEG_D_BIT | SSD_SEG_E_BIT;
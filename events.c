@@ -0,0 +1,122 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * Queue of deferred work.
+ * Interrupt handlers only post an event code, the work itself (menu, relay
+ * control, EEPROM programming) is done by runEvents() in the main loop.
+ * All interrupts have the same priority and do not preempt each other, so
+ * handlers act as a single producer and main() is the single consumer:
+ * the head index is written only by producer and the tail index only by
+ * consumer, no locking is needed.
+ */
+
+#include "events.h"
+#include "menu.h"
+#include "relay.h"
+
+#define EVENTS_QUEUE_SIZE   8   // Power of two
+#define EVENTS_QUEUE_MASK   (EVENTS_QUEUE_SIZE - 1)
+
+static unsigned char queue[EVENTS_QUEUE_SIZE];
+// Shared between interrupt handlers and main().
+static volatile unsigned char head;
+static volatile unsigned char tail;
+static unsigned char lost;
+
+/**
+ * @brief Makes the queue empty.
+ */
+void initEvents()
+{
+    head = 0;
+    tail = 0;
+    lost = 0;
+}
+
+/**
+ * @brief Adds the event to the queue. Called from interrupt handlers only.
+ *  The event is dropped when the queue is full.
+ * @param event - event code.
+ */
+void postEvent (unsigned char event)
+{
+    unsigned char next = (head + 1) & EVENTS_QUEUE_MASK;
+
+    if (next == tail) {
+        if (lost < 0xFF) {
+            lost++;
+        }
+
+        return;
+    }
+
+    queue[head] = event;
+    head = next;
+}
+
+/**
+ * @brief Takes the oldest event from the queue. Called from main() only.
+ * @return event code or EVENT_NONE when the queue is empty.
+ */
+unsigned char getEvent()
+{
+    unsigned char event;
+
+    if (tail == head) {
+        return EVENT_NONE;
+    }
+
+    event = queue[tail];
+    tail = (tail + 1) & EVENTS_QUEUE_MASK;
+    return event;
+}
+
+/**
+ * @brief Gets the number of events dropped because of the full queue.
+ * @return amount of lost events, saturated at 255.
+ */
+unsigned char getEventsLost()
+{
+    return lost;
+}
+
+/**
+ * @brief Handles all pending events. Called from the main loop after
+ *  each wake-up.
+ */
+void runEvents()
+{
+    unsigned char event;
+
+    while ( (event = getEvent() ) != EVENT_NONE) {
+        switch (event) {
+        case EVENT_REFRESH_MENU:
+            refreshMenu();
+            break;
+
+        case EVENT_REFRESH_RELAY:
+            refreshRelay();
+            break;
+
+        default:
+            feedMenu (event);
+            break;
+        }
+    }
+}
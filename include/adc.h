@@ -18,11 +18,53 @@
 #ifndef ADC_H
 #define ADC_H
 
+/*
+ * Acquisition mode:
+ *  0 - single conversion and one interrupt per sample;
+ *  1 - continuous conversions into the ADC_DBxR hardware buffer, one
+ *      interrupt per block of 10 samples, the block is averaged at once.
+ */
+#ifndef ADC_BUFFERED_SCAN
+#define ADC_BUFFERED_SCAN       0
+#endif
+
+/* Fractional bits of the extended resolution temperature (1/16 of 0.1 C) */
+#define ADC_FINE_BITS           4
+
+/* States of the analog watchdog */
+#define ADC_WATCHDOG_NONE       0
+#define ADC_WATCHDOG_OVER       1
+#define ADC_WATCHDOG_UNDER      2
+
+/* Sensor faults, latched until cleared and shown as E01..E03 */
+#define ADC_SENSOR_OK           0
+#define ADC_SENSOR_OPEN         1
+#define ADC_SENSOR_SHORT        2
+#define ADC_SENSOR_SLEW         3
+
+/* Tick mask for startADC(): 64 samples per decimated value every 512 ms */
+#if ADC_BUFFERED_SCAN
+#define ADC_START_MASK          0x1F
+#else
+#define ADC_START_MASK          0x03
+#endif
+
 void initADC();
+void setAdcClock (unsigned char);
 void startADC();
+void requestADC();
+void suspendADC();
+void resumeADC();
+unsigned char startPendingADC();
 int getTemperature();
+int getTemperatureFine();
+unsigned char getTemperatureSeq();
 unsigned int getAdcResult();
 unsigned int getAdcAveraged();
+unsigned char getAdcWatchdog();
+void updateAdcWatchdog();
+unsigned char getSensorFault();
+void clearSensorFault();
 void ADC1_EOC_handler() __interrupt (22);
 
 #endif
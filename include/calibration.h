@@ -0,0 +1,31 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#define CALIBRATION_OFF         0
+#define CALIBRATION_READY       1
+#define CALIBRATION_RUNNING     2
+
+void initCalibration();
+void startCalibration();
+void cancelCalibration();
+void markCalibration();
+unsigned char getCalibrationState();
+
+#endif
@@ -26,6 +26,7 @@
 
 void initDisplay();
 void refreshDisplay();
+void resumeDisplay();
 void setDisplayInt (int);
 void setDisplayOff (bool val);
 void setDisplayStr (const unsigned char*);
@@ -0,0 +1,36 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+/*
+ * Events posted by interrupt handlers and handled in main().
+ * Codes below EVENT_REFRESH_MENU are menu button events (MENU_EVENT_*).
+ */
+#define EVENT_REFRESH_MENU      0x10
+#define EVENT_REFRESH_RELAY     0x11
+#define EVENT_NONE              0xFF
+
+void initEvents();
+void postEvent (unsigned char);
+unsigned char getEvent();
+unsigned char getEventsLost();
+void runEvents();
+
+#endif
@@ -23,6 +23,15 @@
 #define MENU_SET_TIMER     1
 #define MENU_SELECT_PARAM  2
 #define MENU_CHANGE_PARAM  3
+#define MENU_DIAGNOSTIC    4
+/* Items of the diagnostic menu */
+#define MENU_DIAG_DEAD_TIME         0
+#define MENU_DIAG_TIME_CONSTANT     1
+#define MENU_DIAG_GAIN              2
+#define MENU_DIAG_CYCLES            3
+#define MENU_DIAG_ON_TIME           4
+#define MENU_DIAG_LONGEST_RUN       5
+#define MENU_DIAG_COUNT             6
 /* Menu events */
 #define MENU_EVENT_PUSH_BUTTON1     0
 #define MENU_EVENT_PUSH_BUTTON2     1
@@ -35,6 +44,7 @@
 void initMenu();
 void refreshMenu();
 unsigned char getMenuDisplay();
+unsigned char getDiagnosticItem();
 void feedMenu (unsigned char event);
 
 #endif
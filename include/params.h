@@ -18,16 +18,50 @@
 #ifndef PARAMS_H
 #define PARAMS_H
 
+#ifndef bool
+#define bool    _Bool
+#define true    1
+#define false   0
+#endif
+
+/* Layout of the data EEPROM */
+#ifndef EEPROM_BASE_ADDR                // Overridden by the host tests
+#define EEPROM_BASE_ADDR            0x4000
+#endif
+#define EEPROM_CHECKPOINT_OFFSET    0       // 3 slots of 8 bytes, see checkpoint.c
+#define EEPROM_CALIBRATION_OFFSET   24      // 4 bytes, see calibration.c
+#define EEPROM_BOOT_COUNT_OFFSET    28      // 2 bytes, see timer.c
+#define EEPROM_LAYOUT_OFFSET        30      // 1 byte, see params.c
+#define EEPROM_PROFILE_OFFSET       32      // 21 bytes, see profile.c
+#define EEPROM_MODEL_OFFSET         56      // 7 bytes, see relay.c
+#define EEPROM_STATS_OFFSET         64      // 2 slots of 11 bytes, see relay.c
+#define EEPROM_PARAMS_EXT_OFFSET    96      // Parameters from PARAM_RELAY_MIN_ON_TIME on
+#define EEPROM_PARAMS_OFFSET        100
+#define EEPROM_BYTE(offset)         (* (unsigned char*) (EEPROM_BASE_ADDR + (offset) ) )
+
 /* Definition for parameter identifiers */
 #define PARAM_RELAY_MODE                0
 #define PARAM_RELAY_HYSTERESIS          1
 #define PARAM_MAX_TEMPERATURE           2
 #define PARAM_MIN_TEMPERATURE           3
 #define PARAM_TEMPERATURE_CORRECTION    4
-#define PARAM_RELAY_DELAY               5
+#define PARAM_RELAY_MIN_OFF_TIME        5
 #define PARAM_OVERHEAT_INDICATION       6
 #define PARAM_THRESHOLD                 7
+#define PARAM_CONTROL_MODE              8
 #define PARAM_FERMENTATION_TIME         9
+#define PARAM_PID_GAIN                  10
+#define PARAM_PID_INTEGRAL_TIME         11
+#define PARAM_PID_DERIVATIVE_TIME       12
+#define PARAM_PROFILE                   13
+#define PARAM_RELAY_MIN_ON_TIME         14
+#define PARAM_COUNT                     15
+
+/* Values of PARAM_CONTROL_MODE */
+#define CONTROL_MODE_HYSTERESIS         0
+#define CONTROL_MODE_PID                1
+#define CONTROL_MODE_AUTOTUNE           2
+#define CONTROL_MODE_PREDICTIVE         3
 
 int getParam();
 void incParam();
@@ -35,6 +69,10 @@ void decParam();
 void incParamId();
 void decParamId();
 void storeParams();
+unsigned char checkRecord (const unsigned char*, unsigned char);
+void storeRecord (unsigned char, const unsigned char*, unsigned char);
+bool isRecordStored();
+void refreshRecord();
 void initParamsEEPROM();
 unsigned char getParamId();
 int getParamById (unsigned char);
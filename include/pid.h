@@ -0,0 +1,33 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PID_H
+#define PID_H
+
+/* Results of refreshAutotune() */
+#define AUTOTUNE_OFF        0
+#define AUTOTUNE_ON         1
+#define AUTOTUNE_DONE       2
+#define AUTOTUNE_FAILED     3
+
+void resetPID();
+unsigned char computePID (int, int);
+void startAutotune();
+unsigned char refreshAutotune (int, int);
+unsigned char getAutotuneCycle();
+
+#endif
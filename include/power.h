@@ -0,0 +1,44 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef POWER_H
+#define POWER_H
+
+#ifndef bool
+#define bool    _Bool
+#define true    1
+#define false   0
+#endif
+
+/*
+ * CPU clock is the 16 MHz HSI divided by 2^shift (CLK_CKDIVR.HSIDIV, 0..3).
+ * Peripheral prescalers are derived from the shift, see setCpuClock().
+ */
+#define CLOCK_HSI_KHZ           16000
+#define CLOCK_NORMAL_SHIFT      3       // 2 MHz
+#define CLOCK_BOOST_SHIFT       0       // 16 MHz
+
+void initPower();
+void idlePower();
+unsigned char getClockShift();
+unsigned int getCpuKhz();
+void boostClock();
+void releaseClock();
+void AWU_handler() __interrupt (1);
+
+#endif
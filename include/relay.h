@@ -24,10 +24,21 @@
 #define false   0
 #endif
 
+#define RELAY_WINDOW_SECONDS    20  // Period of the time-proportional output
+
 void initRelay();
 void buzzRelay ();
 void refreshRelay();
+void forceRelayOff();
 bool isRelayEnabled();
 void enableRelay (bool state);
+unsigned int getModelDeadTime();
+unsigned int getModelTimeConstant();
+unsigned char getModelGain();
+signed char getModelAmbient();
+unsigned long getRelayCycles();
+unsigned long getRelayOnTime();
+unsigned int getRelayLongestRun();
+void resetRelayStats();
 
 #endif
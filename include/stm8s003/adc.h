@@ -18,7 +18,7 @@
 #ifndef STM8S003_ADC_H
 #define STM8S003_ADC_H
 
-#define	ADC_DBxR	*(unsigned char[0x14]*)0x0053E0	// ADC data buffer registers
+#define	ADC_DBxR	(*(unsigned char (*)[0x14])0x0053E0)	// ADC data buffer registers
 #define	ADC_CSR		*(unsigned char*)0x005400	// ADC control/status register
 #define	ADC_CR1		*(unsigned char*)0x005401	// ADC configuration register 1
 #define	ADC_CR2		*(unsigned char*)0x005402	// ADC configuration register 2
@@ -0,0 +1,26 @@
+/* 
+ * This file is part of the W1209 firmware replacement project
+ * (https://github.com/mister-grumbler/w1209-firmware).
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef STM8S003_AWU_H
+#define STM8S003_AWU_H
+
+#define	AWU_CSR1	*(unsigned char*)0x0050F0	// AWU control/status register 1
+#define	AWU_APR		*(unsigned char*)0x0050F1	// AWU asynchronous prescaler buffer register
+#define	AWU_TBR		*(unsigned char*)0x0050F2	// AWU timebase selection register
+
+#endif
\ No newline at end of file
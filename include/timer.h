@@ -24,17 +24,48 @@
 #define false   0
 #endif
 
+#define TICKS_IN_SECOND     500
+
+/* Store the number of device starts in EEPROM, see getBootCount() */
+#ifndef TIMER_BOOT_COUNTER
+#define TIMER_BOOT_COUNTER  1
+#endif
+
+/* Consistent copy of the time counters, see getTimeSnapshot() */
+typedef struct {
+    unsigned long uptime;           // Seconds since reset
+    unsigned int ticks;             // Ticks within the current second
+    unsigned char seconds;
+    unsigned char minutes;
+    unsigned char hours;
+    unsigned int days;
+    unsigned long fTimerRemaining;  // Fermentation timer, seconds remaining
+    unsigned char fTimerHours;
+    unsigned char fTimerMinutes;
+} TimeSnapshot;
+
 void initTimer();
+void setTimerClock (unsigned char);
+void setTimerCorrection (int);
 void startFTimer();
 void stopFTimer();
+void resumeFTimer (unsigned long, bool);
+void pauseFTimer (bool);
+bool isFTimerPaused();
+unsigned long getFTimerRemaining();
 void resetUptime();
+void advanceUptime (unsigned int);
 bool isFTimer();
 unsigned long getUptime();
 unsigned int getUptimeTicks();
 unsigned char getUptimeSeconds();
 unsigned char getUptimeMinutes();
 unsigned char getUptimeHours();
-unsigned char getUptimeDays();
+unsigned int getUptimeDays();
+unsigned int getBootCount();
+void getTimeSnapshot (TimeSnapshot*);
+unsigned char getTaskOverruns (unsigned char);
+unsigned int getTaskLongest (unsigned char);
 void uptimeToString (unsigned char*, const unsigned char*);
 void TIM4_UPD_handler() __interrupt (23);
 
@@ -20,9 +20,12 @@
  */
 
  #include "menu.h"
+ #include "adc.h"
  #include "buttons.h"
+ #include "calibration.h"
  #include "display.h"
  #include "params.h"
+ #include "profile.h"
  #include "timer.h"
  #include "relay.h"
  
@@ -35,6 +38,7 @@
  // Статические переменные меню
  static unsigned char menuDisplay;    // Текущее отображаемое меню
  static unsigned char menuState;     // Текущее состояние меню
+ static unsigned char diagItem;     // Показываемый пункт диагностики
  /* Счетчик таймера меню. Увеличивается при каждом вызове refreshMenu().
     Используется для обработки таймаутов меню и действий при удержании кнопки. */
  static unsigned int timer;
@@ -47,6 +51,7 @@
  void initMenu(void)
  {
      timer = 0;
+     diagItem = 0;
      menuState = menuDisplay = MENU_ROOT;  // Начинаем с корневого меню
  }
  
@@ -59,6 +64,15 @@
      return menuDisplay;
  }
  
+ /**
+  * @brief Получение пункта меню диагностики для отображения.
+  * @return Номер пункта (MENU_DIAG_...)
+  */
+ unsigned char getDiagnosticItem(void)
+ {
+     return diagItem;
+ }
+ 
  /**
   * @brief Обновление состояния меню приложения и обработка событий.
   * @param event Событие меню (нажатие/отпускание кнопок или проверка таймера)
@@ -67,6 +81,7 @@
   *  MENU_ROOT          - Корневое меню
   *  MENU_SELECT_PARAM  - Выбор параметра
   *  MENU_CHANGE_PARAM  - Изменение параметра
+  *  MENU_DIAGNOSTIC    - Диагностика (модель нагрева, износ реле)
   *  MENU_SET_TIMER     - Установка таймера
   *
   * Возможные события:
@@ -97,20 +112,40 @@
          case MENU_EVENT_CHECK_TIMER:
              if (timer > MENU_3_SEC_PASSED) {
                  timer = 0;
+                 menuDisplay = MENU_ROOT;   // Долгое нажатие - не диагностика
  
                  if (getButton1()) {
                      // Долгое нажатие кнопки 1 - вход в меню параметров
                      setParamId(0);
                      menuState = menuDisplay = MENU_SELECT_PARAM;
+                 } else if (getCalibrationState() != CALIBRATION_OFF) {
+                     if (getButton3()) {    // Отмена калибровки тактовой частоты
+                         cancelCalibration();
+                     }
+                 } else if (getButton2() && getButton3()) {
+                     startCalibration();    // Калибровка тактовой частоты
                  } else {
                      if (getButton2()) {    // Вкл/выкл термостата
-                         if (isRelayEnabled() && !isFTimer()) {
+                         if (getSensorFault() != ADC_SENSOR_OK) {
+                             clearSensorFault();    // Подтверждение ошибки датчика
+                         } else if (isFTimer()) {   // Пауза/продолжение таймера ферментации
+                             pauseFTimer(!isFTimerPaused());
+                         } else if (isRelayEnabled()) {
                              enableRelay(false);
                          } else {
                              enableRelay(true);
                          }
                      } else if (getButton3()) { // Старт/стоп таймера ферментации
-                         if (isFTimer()) {
+                         if (getParamById(PARAM_PROFILE)) {
+                             // Партия по профилю ферментации вместо таймера
+                             if (isProfile()) {
+                                 stopProfile();
+                                 enableRelay(false);
+                             } else {
+                                 startProfile();
+                                 enableRelay(true);
+                             }
+                         } else if (isFTimer()) {
                              stopFTimer();
                              enableRelay(false);
                          } else {
@@ -122,6 +157,27 @@
              }
              break;
  
+         case MENU_EVENT_PUSH_BUTTON2:
+             // Отметка начала/конца эталонного интервала калибровки
+             if (getCalibrationState() != CALIBRATION_OFF && !getButton3()) {
+                 timer = 0;
+                 markCalibration();
+                 break;
+             }
+ 
+             // Короткое нажатие кнопки 2 - меню диагностики
+             timer = 0;
+             diagItem = 0;
+             menuDisplay = MENU_DIAGNOSTIC;
+             break;
+ 
+         case MENU_EVENT_RELEASE_BUTTON2:
+             if (menuDisplay == MENU_DIAGNOSTIC) {
+                 menuState = MENU_DIAGNOSTIC;
+             }
+             timer = 0;
+             break;
+ 
          default:
              if (timer > MENU_5_SEC_PASSED) {
                  timer = 0;
@@ -234,6 +290,58 @@
              break;
          }
      } 
+     else if (menuState == MENU_DIAGNOSTIC) {
+         // Меню диагностики
+         switch (event) {
+         case MENU_EVENT_PUSH_BUTTON1:
+             timer = 0;
+             menuDisplay = MENU_ROOT;
+             break;
+ 
+         case MENU_EVENT_RELEASE_BUTTON1:
+             menuState = MENU_ROOT;
+             timer = 0;
+             break;
+ 
+         case MENU_EVENT_PUSH_BUTTON2:
+             if (++diagItem >= MENU_DIAG_COUNT) {
+                 diagItem = 0;
+             }
+             // Продолжение в следующий case (нет break)
+         case MENU_EVENT_RELEASE_BUTTON2:
+             timer = 0;
+             break;
+ 
+         case MENU_EVENT_PUSH_BUTTON3:
+             if (diagItem > 0) {
+                 diagItem--;
+             } else {
+                 diagItem = MENU_DIAG_COUNT - 1;
+             }
+             // Продолжение в следующий case (нет break)
+         case MENU_EVENT_RELEASE_BUTTON3:
+             timer = 0;
+             break;
+ 
+         case MENU_EVENT_CHECK_TIMER:
+             // Удержание кнопок 2 и 3 на счетчиках реле - сброс статистики
+             if (diagItem >= MENU_DIAG_CYCLES && getButton2() && getButton3()
+                     && timer > MENU_5_SEC_PASSED) {
+                 timer = 0;
+                 resetRelayStats();
+             }
+
+             // Таймаут возврата в корневое меню
+             if (timer > MENU_5_SEC_PASSED * 2) {
+                 timer = 0;
+                 menuState = menuDisplay = MENU_ROOT;
+             }
+             break;
+ 
+         default:
+             break;
+         }
+     } 
      else if (menuState == MENU_SET_TIMER) {
          // Меню установки таймера
          switch (event) {
@@ -314,9 +422,9 @@
  }
  
  /**
-  * @brief Функция обновления меню, вызываемая из прерывания таймера.
-  * @note Должна быть максимально быстрой, так как вызывается в прерывании.
-  *       Обрабатывает всю временную логику меню: быстрое изменение значений
+  * @brief Функция обновления меню, вызываемая из главного цикла по событию
+  *        таймера (EVENT_REFRESH_MENU) каждые 16 тиков.
+  * @note Обрабатывает всю временную логику меню: быстрое изменение значений
   *       при удержании кнопки, возврат в корневое меню при бездействии и т.д.
   */
  void refreshMenu(void)
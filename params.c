@@ -27,25 +27,104 @@
  * P2 - |110| 110 ... -45 - Maximum allowed temperature value
  * P3 - |-50| -50 ... 105 Minimum allowed temperature value
  * P4 - | 0 | 7.0 ... -7.0 Correction of temperature value
- * P5 - | 0 | 0 ... 10 Relay switching delay in minutes
+ * P5 - | 0 | 0 ... 999 Minimum relay off time in seconds
  * P6 - |Off| On/Off Indication of overheating
  * P7 - | 44| Threshold value in degrees of Celsius
+ * P8 - | 0 | 0 ... 3 Control mode: 0 - hysteresis, 1 - PID,
+ *            2 - PID auto-tuning (switches to 1 when finished),
+ *            3 - hysteresis with prediction by the learned thermal model
  * FT - | 8h| 1h ... 15h Fermentation time in hours
+ * PA - | 30| 0.1 ... 99.9 PID gain, % of relay duty per degree
+ * PB - | 20| 0 ... 240 PID integral time in minutes, 0 - off
+ * PC - |120| 0 ... 999 PID derivative time in seconds, 0 - off
+ * PD - | 0 | 0 ... 1 Batch by the fermentation profile instead of the timer
+ * PE - | 0 | 0 ... 999 Minimum relay on time in seconds
+ *
+ * Parameters are stored as ints from EEPROM_PARAMS_OFFSET, the block is full
+ * at PD, so the later ones are stored from EEPROM_PARAMS_EXT_OFFSET.
+ *
+ * The byte at EEPROM_LAYOUT_OFFSET holds the version of the EEPROM content.
+ * An older firmware left it erased (zero), the content of such a device is
+ * converted once on start, see migrateEEPROM().
+ *
+ * Records of other modules (see the layout in params.h) are written by
+ * storeRecord() one byte per pass of the main loop, and the next byte is
+ * only started when the programming of the previous one is finished, so
+ * the main loop and the interrupts are delayed by a single byte programming
+ * time at most. Bytes equal to the old content are not programmed at all.
+ * A record ends with the check byte from checkRecord(), which is written
+ * last, so an erased or partially written record is not valid.
  */
 
 #include "params.h"
 #include "stm8s003/prom.h"
 #include "buttons.h"
+#include "adc.h"
+#include "power.h"
 
-/* Definitions for EEPROM */
-#define EEPROM_BASE_ADDR        0x4000
-#define EEPROM_PARAMS_OFFSET    100
+#define EEPROM_LAYOUT           2       // Version of the EEPROM content
+#define OLD_RELAY_DELAY_MAX     10      // P5 of layout 0, minutes
 
 static unsigned char paramId;
-static int paramCache[10];
-const int paramMin[] = {0, 1, 30, 10, -70, 0, 0, 300, 0, 1};
-const int paramMax[] = {1, 150, 70, 45, 70, 10, 1, 550, 0, 15};
-const int paramDefault[] = {0, 20, 50, 20, 0, 0, 0, 440, 0, 8};
+static int paramCache[PARAM_COUNT];
+/* The record being written by refreshRecord(). */
+static const unsigned char* recordData;
+static unsigned char recordOffset;
+static unsigned char recordSize;
+static unsigned char recordPos;
+const int paramMin[] = {0, 1, 30, 10, -70, 0, 0, 300, 0, 1, 1, 0, 0, 0, 0};
+const int paramMax[] = {1, 150, 70, 45, 70, 999, 1, 550, 3, 15, 999, 240, 999, 1, 999};
+const int paramDefault[] = {0, 20, 50, 20, 0, 0, 0, 440, 0, 8, 300, 20, 120, 0, 0};
+
+/**
+ * @brief Gets the location of the parameter in EEPROM.
+ * @param id
+ *  the identifier of the parameter.
+ * @return pointer to the stored value.
+ */
+static int* paramAddress (unsigned char id)
+{
+    if (id >= PARAM_RELAY_MIN_ON_TIME) {
+        return (int*) (EEPROM_BASE_ADDR + EEPROM_PARAMS_EXT_OFFSET
+                       + ( (id - PARAM_RELAY_MIN_ON_TIME) * sizeof paramCache[0]) );
+    }
+
+    return (int*) (EEPROM_BASE_ADDR + EEPROM_PARAMS_OFFSET + (id * sizeof paramCache[0]) );
+}
+
+/**
+ * @brief Converts the content written by an older firmware to the current
+ *  layout. A conversion which is interrupted by a power loss is repeated
+ *  on the next start, so every step must be safe to be done twice.
+ */
+static void migrateEEPROM()
+{
+    static const unsigned char blank[EEPROM_CALIBRATION_OFFSET - EEPROM_CHECKPOINT_OFFSET] = {0};
+    static unsigned char layout;
+
+    layout = EEPROM_BYTE (EEPROM_LAYOUT_OFFSET);
+
+    if (layout >= EEPROM_LAYOUT) {
+        return;
+    }
+
+    // 1: P5 is the minimum relay off time in seconds, it was the switching
+    // delay in minutes (0 ... 10).
+    if (layout < 1 && paramCache[PARAM_RELAY_MIN_OFF_TIME] <= OLD_RELAY_DELAY_MAX) {
+        paramCache[PARAM_RELAY_MIN_OFF_TIME] *= 60;
+        storeParams();
+    }
+
+    // 2: checkpoints have grown from 6 to 8 bytes, the old ones are cleared
+    // so that no part of them is taken for a valid record.
+    if (layout < 2) {
+        storeRecord (EEPROM_CHECKPOINT_OFFSET, blank, sizeof blank);
+    }
+
+    // Also finishes the records above before initCheckpoint() reads them.
+    layout = EEPROM_LAYOUT;
+    storeRecord (EEPROM_LAYOUT_OFFSET, &layout, 1);
+}
 
 /**
  * @brief Check values in the EEPROM to be correct then load them into
@@ -55,19 +134,25 @@ void initParamsEEPROM()
 {
     if (getButton2() && getButton3() ) {
         // Restore parameters to default values
-        for (paramId = 0; paramId < 10; paramId++) {
+        for (paramId = 0; paramId < PARAM_COUNT; paramId++) {
             paramCache[paramId] = paramDefault[paramId];
         }
 
         storeParams();
     } else {
-        // Load parameters from EEPROM
-        for (paramId = 0; paramId < 10; paramId++) {
-            paramCache[paramId] = * (int*) (EEPROM_BASE_ADDR + EEPROM_PARAMS_OFFSET
-                                            + (paramId * sizeof paramCache[0]) );
+        // Load parameters from EEPROM, the ones out of range (never stored
+        // by an older firmware) get default values.
+        for (paramId = 0; paramId < PARAM_COUNT; paramId++) {
+            paramCache[paramId] = *paramAddress (paramId);
+
+            if (paramCache[paramId] < paramMin[paramId]
+                    || paramCache[paramId] > paramMax[paramId]) {
+                paramCache[paramId] = paramDefault[paramId];
+            }
         }
     }
 
+    migrateEEPROM();
     paramId = 0;
 }
 
@@ -78,7 +163,7 @@ void initParamsEEPROM()
  */
 int getParamById (unsigned char id)
 {
-    if (id < 10) {
+    if (id < PARAM_COUNT) {
         return paramCache[id];
     }
 
@@ -92,7 +177,7 @@ int getParamById (unsigned char id)
  */
 void setParamById (unsigned char id, int val)
 {
-    if (id < 10) {
+    if (id < PARAM_COUNT) {
         paramCache[id] = val;
     }
 }
@@ -154,32 +239,40 @@ unsigned char getParamId()
  */
 void setParamId (unsigned char val)
 {
-    if (val < 10) {
+    if (val < PARAM_COUNT) {
         paramId = val;
     }
 }
 
 /**
- * @brief
+ * @brief Selects the next parameter. The fermentation time is skipped,
+ *  it is set from its own menu.
  */
 void incParamId()
 {
-    if (paramId < 7) {
+    if (++paramId == PARAM_FERMENTATION_TIME) {
         paramId++;
-    } else {
+    }
+
+    if (paramId >= PARAM_COUNT) {
         paramId = 0;
     }
 }
 
 /**
- * @brief
+ * @brief Selects the previous parameter. The fermentation time is skipped,
+ *  it is set from its own menu.
  */
 void decParamId()
 {
     if (paramId > 0) {
         paramId--;
     } else {
-        paramId = 7;
+        paramId = PARAM_COUNT - 1;
+    }
+
+    if (paramId == PARAM_FERMENTATION_TIME) {
+        paramId--;
     }
 }
 
@@ -221,7 +314,7 @@ void paramToString (unsigned char id, unsigned char* strBuff)
         itofpa (paramCache[id], strBuff, 0);
         break;
 
-    case PARAM_RELAY_DELAY:
+    case PARAM_RELAY_MIN_OFF_TIME:
         itofpa (paramCache[id], strBuff, 6);
         break;
 
@@ -243,10 +336,34 @@ void paramToString (unsigned char id, unsigned char* strBuff)
         itofpa (paramCache[id], strBuff, 0);
         break;
 
+    case PARAM_CONTROL_MODE:
+        itofpa (paramCache[id], strBuff, 6);
+        break;
+
     case PARAM_FERMENTATION_TIME:
         itofpa (paramCache[id], strBuff, 6);
         break;
 
+    case PARAM_PID_GAIN:
+        itofpa (paramCache[id], strBuff, 0);
+        break;
+
+    case PARAM_PID_INTEGRAL_TIME:
+        itofpa (paramCache[id], strBuff, 6);
+        break;
+
+    case PARAM_PID_DERIVATIVE_TIME:
+        itofpa (paramCache[id], strBuff, 6);
+        break;
+
+    case PARAM_PROFILE:
+        itofpa (paramCache[id], strBuff, 6);
+        break;
+
+    case PARAM_RELAY_MIN_ON_TIME:
+        itofpa (paramCache[id], strBuff, 6);
+        break;
+
     default: // Display "OFF" to all unknown ID
         ( (unsigned char*) strBuff) [0] = 'O';
         ( (unsigned char*) strBuff) [1] = 'F';
@@ -262,6 +379,9 @@ void storeParams()
 {
     unsigned char i;
 
+    // Full speed for the burst of EEPROM programming.
+    boostClock();
+
     //  Check if the EEPROM is write-protected.  If it is then unlock the EEPROM.
     if ( (FLASH_IAPSR & 0x08) == 0) {
         FLASH_DUKR = 0xAE;
@@ -269,35 +389,102 @@ void storeParams()
     }
 
     //  Write to the EEPROM parameters which value is changed.
-    for (i = 0; i < 10; i++) {
-        if (paramCache[i] != (* (int*) (EEPROM_BASE_ADDR + EEPROM_PARAMS_OFFSET
-                                        + (i * sizeof paramCache[0]) ) ) ) {
-            * (int*) (EEPROM_BASE_ADDR + EEPROM_PARAMS_OFFSET
-                      + (i * sizeof paramCache[0]) ) = paramCache[i];
+    for (i = 0; i < PARAM_COUNT; i++) {
+        if (paramCache[i] != *paramAddress (i) ) {
+            *paramAddress (i) = paramCache[i];
         }
     }
 
     //  Now write protect the EEPROM.
     FLASH_IAPSR &= ~0x08;
+    releaseClock();
+
+    // Temperature limits may have been changed.
+    updateAdcWatchdog();
 }
+
 /**
- * @brief
- * @param val
+ * @brief Calculates the check byte of a record.
+ * @param data
+ *  pointer to the record, in RAM or in EEPROM.
+ * @param size
+ *  size of the record including the check byte.
+ * @return complement of the sum of all bytes except the last one.
+ */
+unsigned char checkRecord (const unsigned char* data, unsigned char size)
+{
+    unsigned char i, sum = 0;
+
+    for (i = 0; i < size - 1; i++) {
+        sum += data[i];
+    }
+
+    return ~sum;
+}
+
+/**
+ * @brief Starts writing a record into EEPROM, the bytes are programmed by
+ *  refreshRecord(). The data is not copied and must stay unchanged until
+ *  isRecordStored(). A record still being written is finished first, which
+ *  stalls the caller for its remaining bytes.
  * @param offset
+ *  offset of the record from the start of EEPROM.
+ * @param data
+ *  pointer to the record.
+ * @param size
+ *  size of the record.
  */
-static void writeEEPROM (unsigned char val, unsigned char offset)
+void storeRecord (unsigned char offset, const unsigned char* data, unsigned char size)
 {
-    //  Check if the EEPROM is write-protected.  If it is then unlock the EEPROM.
-    if ( (FLASH_IAPSR & 0x08) == 0) {
-        FLASH_DUKR = 0xAE;
-        FLASH_DUKR = 0x56;
+    while (!isRecordStored() ) {
+        refreshRecord();
     }
 
-    //  Write the data to the EEPROM.
-    (* (unsigned char*) (EEPROM_BASE_ADDR + offset) ) = val;
+    recordData = data;
+    recordOffset = offset;
+    recordSize = size;
+    recordPos = 0;
+}
 
-    //  Now write protect the EEPROM.
-    FLASH_IAPSR &= ~0x08;
+/**
+ * @brief Checks the last record to be written completely.
+ */
+bool isRecordStored()
+{
+    return recordPos >= recordSize;
+}
+
+/**
+ * @brief Programs the next changed byte of the record. Called on every
+ *  pass of the main loop.
+ */
+void refreshRecord()
+{
+    // Nothing to write, or the previous byte is still being programmed
+    // (HVOFF is not set).
+    if (recordPos >= recordSize || (FLASH_IAPSR & 0x40) == 0) {
+        return;
+    }
+
+    while (recordPos < recordSize
+            && EEPROM_BYTE (recordOffset + recordPos) == recordData[recordPos]) {
+        recordPos++;
+    }
+
+    if (recordPos < recordSize) {
+        //  Unlock the EEPROM, it may have been locked by storeParams() meanwhile.
+        if ( (FLASH_IAPSR & 0x08) == 0) {
+            FLASH_DUKR = 0xAE;
+            FLASH_DUKR = 0x56;
+        }
+
+        EEPROM_BYTE (recordOffset + recordPos) = recordData[recordPos];
+        recordPos++;
+    }
+
+    if (recordPos >= recordSize) {
+        FLASH_IAPSR &= ~0x08;
+    }
 }
 
 /**
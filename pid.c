@@ -0,0 +1,247 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * PID controller of the time-proportional relay output.
+ * The controller is in the standard form with the gain and the integral
+ * and derivative times as parameters:
+ *  PA - proportional gain in 0.1% of duty per degree;
+ *  PB - integral time in minutes, 0 disables the integral term;
+ *  PC - derivative time in seconds, 0 disables the derivative term.
+ * It is sampled once per relay window (RELAY_WINDOW_SECONDS) and returns
+ * the duty for the next window.
+ *
+ * Fixed-point: the temperatures are in fine units (1/160 degree), so the
+ * product of the gain and the error is in 1/1600 of percent of duty. All
+ * terms are kept in these units in 32 bits. The derivative acts on the
+ * measurement only, so changes of the setpoint do not kick the output.
+ * Anti-windup: the integral is limited to the output range and is not
+ * accumulated while the output is saturated in the direction of the error.
+ *
+ * Auto-tuning by the relay feedback (Astrom-Hagglund): the relay is switched
+ * fully on below the setpoint and off above it, with a small hysteresis
+ * against the sensor noise. The first cycle (heating from the ambient) is
+ * skipped, then the period Tu and the amplitude a of the temperature are
+ * averaged over AUTOTUNE_CYCLES cycles. With the relay amplitude d = 50%
+ * the ultimate gain is Ku = 4d / (pi * a) and the gains are calculated by
+ * the Ziegler-Nichols rule without overshoot: Kp = 0.2 Ku, Ti = Tu / 2,
+ * Td = Tu / 3. The run is aborted above the maximum allowed temperature
+ * or when a cycle takes longer than AUTOTUNE_TIMEOUT.
+ */
+
+#include "pid.h"
+#include "adc.h"
+#include "params.h"
+#include "relay.h"
+#include "timer.h"
+
+#define PID_OUT_MAX         (100 * 1600L)   // 100% in 1/1600 of percent
+#define AUTOTUNE_CYCLES     3
+#define AUTOTUNE_BAND       (1 << ADC_FINE_BITS)    // 0.1 degree
+#define AUTOTUNE_TIMEOUT    7200            // Seconds, longest cycle
+// Kp in 0.1%/C for the amplitude in fine units: 0.2 * 4 * 50 * 160 * 10 / pi
+#define AUTOTUNE_GAIN       20372L
+
+static long integral;
+static int lastTemp;
+static bool started;
+static unsigned char tuneCycle;
+static bool tuneOn;
+static int tuneMax;
+static int tuneMin;
+static unsigned long tuneStart;
+static unsigned long tunePeriod;
+static long tuneAmplitude;
+
+/**
+ * @brief Resets the state of the controller. The next sample starts
+ *  with an empty integral and no derivative.
+ */
+void resetPID()
+{
+    integral = 0;
+    started = false;
+}
+
+/**
+ * @brief Calculates the duty of the relay for the next window.
+ * @param setpoint
+ *  the target temperature in fine units.
+ * @param temp
+ *  the measured temperature in fine units.
+ * @return duty in percent, 0 ... 100.
+ */
+unsigned char computePID (int setpoint, int temp)
+{
+    int gain = getParamById (PARAM_PID_GAIN);
+    int integralTime = getParamById (PARAM_PID_INTEGRAL_TIME);
+    int derivativeTime = getParamById (PARAM_PID_DERIVATIVE_TIME);
+    long proportional, derivative, out, next;
+
+    if (!started) {
+        lastTemp = temp;
+        started = true;
+    }
+
+    proportional = (long) gain * (setpoint - temp);
+    derivative = (long) gain * (lastTemp - temp) / RELAY_WINDOW_SECONDS * derivativeTime;
+    lastTemp = temp;
+
+    if (integralTime > 0) {
+        next = integral + proportional * RELAY_WINDOW_SECONDS / (integralTime * 60L);
+
+        if (next > PID_OUT_MAX) {
+            next = PID_OUT_MAX;
+        } else if (next < 0) {
+            next = 0;
+        }
+
+        // Conditional integration: keep the integral when saturated.
+        out = proportional + next + derivative;
+
+        if (! (out > PID_OUT_MAX && next > integral) && ! (out < 0 && next < integral) ) {
+            integral = next;
+        }
+    } else {
+        integral = 0;
+    }
+
+    out = proportional + integral + derivative;
+
+    if (out <= 0) {
+        return 0;
+    }
+
+    if (out >= PID_OUT_MAX) {
+        return 100;
+    }
+
+    return out / 1600;
+}
+
+/**
+ * @brief Starts the auto-tuning with the relay on.
+ */
+void startAutotune()
+{
+    tuneCycle = 0;
+    tuneOn = true;
+    tuneMax = -32767;
+    tuneMin = 32767;
+    tunePeriod = 0;
+    tuneAmplitude = 0;
+    tuneStart = getUptime();
+}
+
+/**
+ * @brief Calculates the PID parameters from the averaged cycles and stores
+ *  them. The control mode is switched to PID.
+ */
+static void finishAutotune()
+{
+    long gain, amplitude = tuneAmplitude / AUTOTUNE_CYCLES;
+    unsigned long period = tunePeriod / AUTOTUNE_CYCLES;
+    unsigned long integralTime = (period + 60) / 120;  // Tu / 2 in minutes
+    unsigned long derivativeTime = period / 3;
+
+    if (amplitude < 1) {
+        amplitude = 1;
+    }
+
+    gain = AUTOTUNE_GAIN / amplitude;
+
+    if (gain < 1) {
+        gain = 1;
+    } else if (gain > 999) {
+        gain = 999;
+    }
+
+    if (integralTime < 1) {
+        integralTime = 1;
+    } else if (integralTime > 240) {
+        integralTime = 240;
+    }
+
+    if (derivativeTime > 999) {
+        derivativeTime = 999;
+    }
+
+    setParamById (PARAM_PID_GAIN, gain);
+    setParamById (PARAM_PID_INTEGRAL_TIME, integralTime);
+    setParamById (PARAM_PID_DERIVATIVE_TIME, derivativeTime);
+    setParamById (PARAM_CONTROL_MODE, CONTROL_MODE_PID);
+    storeParams();
+}
+
+/**
+ * @brief Runs the relay feedback of the auto-tuning. Called on every
+ *  refresh of the relay.
+ * @param setpoint
+ *  the target temperature in fine units.
+ * @param temp
+ *  the measured temperature in fine units.
+ * @return AUTOTUNE_ON / AUTOTUNE_OFF - the relay state to be set,
+ *  AUTOTUNE_DONE - the gains are stored, AUTOTUNE_FAILED - aborted.
+ */
+unsigned char refreshAutotune (int setpoint, int temp)
+{
+    unsigned long now = getUptime();
+
+    if (temp >= (getParamById (PARAM_MAX_TEMPERATURE) * 10) << ADC_FINE_BITS
+            || now - tuneStart > AUTOTUNE_TIMEOUT) {
+        return AUTOTUNE_FAILED;
+    }
+
+    if (temp > tuneMax) {
+        tuneMax = temp;
+    }
+
+    if (temp < tuneMin) {
+        tuneMin = temp;
+    }
+
+    if (tuneOn && temp > setpoint + AUTOTUNE_BAND) {
+        tuneOn = false;
+    } else if (!tuneOn && temp < setpoint - AUTOTUNE_BAND) {
+        // A full cycle is over.
+        tuneOn = true;
+
+        if (tuneCycle > 0) {
+            tunePeriod += now - tuneStart;
+            tuneAmplitude += (tuneMax - tuneMin) / 2;
+        }
+
+        tuneStart = now;
+        tuneMax = tuneMin = temp;
+
+        if (++tuneCycle > AUTOTUNE_CYCLES) {
+            finishAutotune();
+            return AUTOTUNE_DONE;
+        }
+    }
+
+    return tuneOn ? AUTOTUNE_ON : AUTOTUNE_OFF;
+}
+
+/**
+ * @brief Gets the progress of the auto-tuning.
+ * @return number of cycles completed, 0 while heating up.
+ */
+unsigned char getAutotuneCycle()
+{
+    return tuneCycle;
+}
@@ -0,0 +1,289 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * Low-power idle.
+ * When the thermostat is disabled, the fermentation timer is stopped and
+ * the menu is idle for POWER_IDLE_SECONDS, the display is blanked, the ADC
+ * is powered down and the MCU enters active-halt mode. The auto-wakeup unit
+ * (AWU, interrupt 1) wakes it about once per second to keep the uptime
+ * running; a button press (EXTI2) leaves the low-power mode and the normal
+ * 500 Hz operation continues from the same point.
+ *
+ * The AWU is clocked by the LSI (128 kHz +-12.5%), so its period is measured
+ * against the HSI by TIM1 input capture (AWU_CSR1.MSR) before each halt
+ * and the uptime is advanced by the measured period. The LSI is enabled
+ * explicitly for it; if it does not start or no capture arrives, the
+ * previous period is kept, and without one the device stays awake.
+ *
+ * Typical current of the MCU alone (STM8S003 datasheet, 25 C), the LED
+ * display, relay coil and thermistor divider are not included:
+ *  - run, 16 MHz HSI, code in flash:                   about 4.5 mA;
+ *  - wait (wfi) between TIM4 ticks, 16 MHz:             about 1.5 mA;
+ *  - active-halt, main regulator and flash powered off: about 10 uA.
+ * The blanked display is the main saving on the board: each lit segment
+ * draws several mA.
+ *
+ * Clock policy: the CPU normally runs at 2 MHz, which leaves about ten
+ * times more cycles per tick than the tick work needs. Bursts such as
+ * EEPROM programming are wrapped in boostClock() / releaseClock() to run
+ * at 16 MHz. TIM4 and ADC prescalers follow every change, so the tick
+ * stays at exactly 500 Hz. The run and wait currents scale roughly with
+ * the clock.
+ */
+
+#include "power.h"
+#include "stm8s003/awu.h"
+#include "stm8s003/clock.h"
+#include "stm8s003/prom.h"
+#include "stm8s003/timer.h"
+#include "adc.h"
+#include "buttons.h"
+#include "calibration.h"
+#include "display.h"
+#include "menu.h"
+#include "params.h"
+#include "relay.h"
+#include "timer.h"
+
+#define HALT                __asm halt __endasm;
+#define WAIT_FOR_INTERRUPT  __asm wfi __endasm;
+
+#define POWER_IDLE_SECONDS  60
+#define POWER_AWU_APR       62      // APRDIV
+#define POWER_AWU_TBR       0x0B    // 2^11 * APRDIV / fLSI = 0.992 s at 128 kHz
+#define POWER_LSI_CAPTURES  16      // Each capture is 8 LSI periods
+#define POWER_LSI_WAIT      4000    // Polls for LSIRDY or a capture, several ms at 16 MHz
+
+static unsigned long lastActive;
+static unsigned long awuPeriod;     // AWU period in 1/256 of tick
+static unsigned int awuFraction;    // Fractional ticks carried between wakeups
+static bool awuWakeup;
+static unsigned char clockShift;
+static unsigned char boostCount;
+
+/**
+ * @brief Resets the idle time.
+ */
+void initPower()
+{
+    lastActive = 0;
+    awuWakeup = false;
+    boostCount = 0;
+    clockShift = CLOCK_NORMAL_SHIFT;
+    CLK_CKDIVR = CLOCK_NORMAL_SHIFT << 3;    // HSIDIV, CPUDIV = 1
+}
+
+/**
+ * @brief Switches the CPU clock and recomputes prescalers of TIM4 and ADC.
+ *  The timer interrupt is masked meanwhile so the tick in progress keeps
+ *  its length.
+ * @param shift
+ *  the clock is CLOCK_HSI_KHZ >> shift.
+ */
+static void setCpuClock (unsigned char shift)
+{
+    unsigned char ier = TIM4_IER;
+
+    TIM4_IER = 0;
+    CLK_CKDIVR = shift << 3;
+    clockShift = shift;
+    setTimerClock (shift);
+    setAdcClock (shift);
+    TIM4_IER = ier;
+}
+
+/**
+ * @brief Gets the current clock divider.
+ * @return shift of the 16 MHz HSI clock.
+ */
+unsigned char getClockShift()
+{
+    return clockShift;
+}
+
+/**
+ * @brief Gets the current CPU clock.
+ * @return frequency in kHz.
+ */
+unsigned int getCpuKhz()
+{
+    return CLOCK_HSI_KHZ >> clockShift;
+}
+
+/**
+ * @brief Runs the CPU at the full speed until the matching releaseClock().
+ *  Calls may be nested. Called from the main loop only.
+ */
+void boostClock()
+{
+    if (boostCount++ == 0) {
+        setCpuClock (CLOCK_BOOST_SHIFT);
+    }
+}
+
+/**
+ * @brief Returns to the normal clock after the last boostClock().
+ */
+void releaseClock()
+{
+    if (boostCount > 0 && --boostCount == 0) {
+        setCpuClock (CLOCK_NORMAL_SHIFT);
+    }
+}
+
+/**
+ * @brief Measures the AWU period with the LSI clock connected to the TIM1
+ *  input capture 1. The counter runs at the CPU clock, one capture is taken
+ *  every 8 LSI periods.
+ * @return false if the LSI is not running, awuPeriod is not changed then.
+ */
+static bool measureAwuPeriod()
+{
+    unsigned int first = 0, last = 0, wait;
+    unsigned char i;
+
+    CLK_ICKR |= 0x08;       // LSI on (LSIEN)
+
+    for (wait = POWER_LSI_WAIT; (CLK_ICKR & 0x10) == 0; wait--) {
+        if (wait == 0) {
+            return false;   // LSIRDY is not set
+        }
+    }
+
+    AWU_CSR1 |= 0x01;       // Connect LSI to TIM1 ICAP1 (MSR)
+    TIM1_PSCRH = 0;         // Count at the CPU clock
+    TIM1_PSCRL = 0;
+    TIM1_CCMR1 = 0x0D;      // CC1 as input on TI1, capture every 8 events
+    TIM1_CCER1 = 0x01;      // Enable capture on rising edge
+    TIM1_CR1 = 0x01;        // Enable counter
+
+    for (i = 0; i <= POWER_LSI_CAPTURES; i++) {
+        TIM1_SR1 = 0;
+
+        for (wait = POWER_LSI_WAIT; (TIM1_SR1 & 0x02) == 0 && wait > 0; wait--);
+
+        if (wait == 0) {
+            break;
+        }
+
+        last = TIM1_CCR1H << 8;     // High byte first, the low byte unlocks
+        last |= TIM1_CCR1L;
+
+        if (i == 0) {
+            first = last;
+        }
+    }
+
+    TIM1_CR1 = 0;
+    TIM1_CCER1 = 0;
+    TIM1_CCMR1 = 0;
+    AWU_CSR1 &= ~0x01;
+
+    if (i <= POWER_LSI_CAPTURES) {
+        return false;       // A capture is missing
+    }
+
+    // (last - first) CPU cycles are 8 * POWER_LSI_CAPTURES = 128 LSI periods,
+    // the AWU period is 2048 * APR LSI periods and the tick is 2 ms.
+    awuPeriod = (unsigned long) (last - first) * POWER_AWU_APR * 2048 / getCpuKhz();
+
+    return true;
+}
+
+/**
+ * @brief Checks whether nothing needs the full-rate operation. An EEPROM
+ *  record being written needs the main loop to finish it.
+ */
+static bool isIdle()
+{
+    return !isRelayEnabled() && !isFTimer() && getMenuDisplay() == MENU_ROOT
+           && getCalibrationState() == CALIBRATION_OFF && isRecordStored()
+           && !getButton1() && !getButton2() && !getButton3();
+}
+
+/**
+ * @brief Enters the active-halt mode when the device has been idle for
+ *  POWER_IDLE_SECONDS. Returns after a wakeup by a button. Called from the
+ *  main loop.
+ */
+void idlePower()
+{
+    if (!isIdle() ) {
+        lastActive = getUptime();
+        return;
+    }
+
+    if (getUptime() - lastActive < POWER_IDLE_SECONDS) {
+        return;
+    }
+
+    // Blank the display on the next tick and stop the ADC.
+    setDisplayOff (true);
+    WAIT_FOR_INTERRUPT;
+    suspendADC();
+
+    // Without a known AWU period the uptime could not be kept: stay awake
+    // and try again after the next idle period.
+    if (!measureAwuPeriod() && awuPeriod == 0) {
+        resumeADC();
+        setDisplayOff (false);
+        lastActive = getUptime();
+        return;
+    }
+
+    awuFraction = 0;
+
+    CLK_ICKR |= 0x20;           // Main regulator off in active-halt (REGAH)
+    FLASH_CR1 |= 0x04;          // Flash powered down in active-halt (AHALT)
+    AWU_APR = POWER_AWU_APR;
+    AWU_TBR = POWER_AWU_TBR;
+    AWU_CSR1 |= 0x10;           // Enable AWU (AWUEN)
+
+    do {
+        awuWakeup = false;
+        HALT;
+    } while (awuWakeup && isIdle() );
+
+    AWU_CSR1 &= ~0x10;
+    AWU_TBR = 0;                // AWU prescaler off
+    CLK_ICKR &= ~0x20;
+    FLASH_CR1 &= ~0x04;
+
+    resumeADC();
+    setDisplayOff (false);
+    lastActive = getUptime();
+}
+
+/**
+ * @brief This function is AWU interrupt request handler.
+ *  Advances the uptime by the measured AWU period.
+ */
+void AWU_handler() __interrupt (1)
+{
+    unsigned int val;
+
+    // Reading the status clears the AWUF flag.
+    if (AWU_CSR1 & 0x20) {
+        awuWakeup = true;
+    }
+
+    val = awuFraction + (unsigned char) awuPeriod;
+    awuFraction = (unsigned char) val;
+    advanceUptime ( (unsigned int) (awuPeriod >> 8) + (val >> 8) );
+}
@@ -0,0 +1,317 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Fermentation profile: a program of up to PROFILE_STEPS steps which drives
+ * the setpoint of the thermostat instead of PARAM_THRESHOLD. Every step has
+ * a target temperature, a ramp rate and a hold time:
+ *  - the setpoint moves to the target at the ramp rate, or at once when
+ *    the rate is zero;
+ *  - the hold time starts when the measured temperature comes within
+ *    PROFILE_SOAK_BAND of the target (guaranteed soak), so slow heating or
+ *    natural cooling does not shorten the step;
+ *  - after the hold the next step starts, after the last one the thermostat
+ *    is disabled.
+ * The program is frozen while a sensor fault is latched.
+ * Targets are limited to the allowed range (P3 ... P2 - 1 degree), so the
+ * over-temperature protection does not stop a step which can never end.
+ * The engine runs off the uptime seconds from refreshRelay(). The step and
+ * its remaining hold time are saved with the checkpoints (see checkpoint.c).
+ *
+ * Table layout in EEPROM, PROFILE_STEP_SIZE bytes per step:
+ * |--Target (0.1 C, 16 bits)--|--Ramp (0.1 C/min)--|--Hold (5 min)--|
+ * 0                           2                    3
+ * The table ends at the first all-zero step or after PROFILE_STEPS steps
+ * and is followed by a check byte, the complement of the sum of the table.
+ * An invalid table is replaced by the default program, which fits the
+ * default limits (20 ... 49 C): heating to 43 C with 15 minutes to add the
+ * culture, and incubation at 43 C for 8 hours. The thermostat is disabled
+ * afterwards, a heater cannot chill the batch anyway.
+ */
+
+#include "profile.h"
+#include "adc.h"
+#include "params.h"
+#include "relay.h"
+#include "timer.h"
+
+#define PROFILE_STEPS           5
+#define PROFILE_STEP_SIZE       4
+#define PROFILE_SIZE            (PROFILE_STEPS * PROFILE_STEP_SIZE)
+#define PROFILE_HOLD_UNIT       300     // Seconds
+#define PROFILE_SOAK_BAND       (5 << ADC_FINE_BITS)    // 0.5 degree
+#define TABLE_BYTE(offset)      EEPROM_BYTE (EEPROM_PROFILE_OFFSET + (offset) )
+
+static const unsigned char defaultProfile[PROFILE_SIZE] = {
+    0x01, 0xAE, 0, 3,       // 43.0 C, 15 minutes
+    0x01, 0xAE, 0, 96,      // 43.0 C, 8 hours
+    0, 0, 0, 0,
+    0, 0, 0, 0,
+    0, 0, 0, 0
+};
+
+static bool running;
+static bool resumed;
+static bool soaking;
+static unsigned char step;
+static unsigned char rate;
+static unsigned int rateSum;
+static int setpoint;
+static int target;
+static unsigned long holdRemaining;
+static unsigned long lastSecond;
+
+/**
+ * @brief Writes the default program into EEPROM when the table is not
+ *  valid. Called once on start.
+ */
+void initProfile()
+{
+    static unsigned char check;
+
+    running = false;
+
+    if (TABLE_BYTE (PROFILE_SIZE) == checkRecord (&TABLE_BYTE (0), PROFILE_SIZE + 1) ) {
+        return;
+    }
+
+    // The check byte is written after the whole table.
+    check = checkRecord (defaultProfile, PROFILE_SIZE + 1);
+    storeRecord (EEPROM_PROFILE_OFFSET, defaultProfile, PROFILE_SIZE);
+    storeRecord (EEPROM_PROFILE_OFFSET + PROFILE_SIZE, &check, 1);
+}
+
+/**
+ * @brief Loads the step from EEPROM.
+ * @param id
+ *  index of the step.
+ * @return false if there is no such step.
+ */
+static bool loadStep (unsigned char id)
+{
+    unsigned char* data = &TABLE_BYTE (id * PROFILE_STEP_SIZE);
+    int maxTemp = (getParamById (PARAM_MAX_TEMPERATURE) - 1) * 10;
+    int minTemp = getParamById (PARAM_MIN_TEMPERATURE) * 10;
+
+    if (id >= PROFILE_STEPS || (data[0] | data[1] | data[2] | data[3]) == 0) {
+        return false;
+    }
+
+    target = (data[0] << 8) | data[1];
+
+    if (target > maxTemp) {
+        target = maxTemp;
+    } else if (target < minTemp) {
+        target = minTemp;
+    }
+
+    target <<= ADC_FINE_BITS;
+    rate = data[2];
+    rateSum = 0;
+    holdRemaining = data[3] * (unsigned long) PROFILE_HOLD_UNIT;
+    soaking = false;
+    step = id;
+
+    return true;
+}
+
+/**
+ * @brief Starts the program from the first step. The setpoint starts
+ *  from the current temperature, so the first ramp is followed as well.
+ */
+void startProfile()
+{
+    setpoint = getTemperatureFine();
+    lastSecond = getUptime();
+    running = loadStep (0);
+    resumed = false;
+}
+
+/**
+ * @brief Resumes the program saved by a checkpoint. The setpoint is set by
+ *  the first refresh: to the target when the hold had started, otherwise
+ *  to the measured temperature, so the ramp is followed again from there.
+ * @param id
+ *  index of the step.
+ * @param remaining
+ *  minutes of the hold remaining, or PROFILE_NOT_SOAKING.
+ */
+void resumeProfile (unsigned char id, unsigned int remaining)
+{
+    lastSecond = getUptime();
+    running = loadStep (id);
+    resumed = true;
+
+    if (remaining != PROFILE_NOT_SOAKING && remaining * 60UL <= holdRemaining) {
+        soaking = true;
+        holdRemaining = remaining * 60UL;
+    }
+}
+
+/**
+ * @brief Stops the program.
+ */
+void stopProfile()
+{
+    running = false;
+}
+
+/**
+ * @brief Runs one second of the program.
+ * @param temp
+ *  the measured temperature in fine units.
+ */
+static void nextProfileSecond (int temp)
+{
+    int delta;              // Fine units, below 70 for any rate
+
+    if (getSensorFault() != ADC_SENSOR_OK) {
+        return;
+    }
+
+    // Ramp: the rate in fine units per minute is summed every second.
+    if (setpoint != target) {
+        if (rate == 0) {
+            setpoint = target;
+        } else {
+            rateSum += rate << ADC_FINE_BITS;
+            delta = rateSum / 60;
+            rateSum -= delta * 60;
+
+            if (setpoint < target) {
+                setpoint = (target - setpoint > delta) ? setpoint + delta : target;
+            } else {
+                setpoint = (setpoint - target > delta) ? setpoint - delta : target;
+            }
+        }
+
+        return;
+    }
+
+    if (!soaking) {
+        soaking = temp > target - PROFILE_SOAK_BAND && temp < target + PROFILE_SOAK_BAND;
+        return;
+    }
+
+    if (holdRemaining > 0) {
+        holdRemaining--;
+        return;
+    }
+
+    if (!loadStep (step + 1) ) {
+        running = false;
+        enableRelay (false);
+    }
+}
+
+/**
+ * @brief Advances the program by the seconds passed since the last call.
+ *  Called on every refresh of the relay.
+ * @param temp
+ *  the measured temperature in fine units.
+ */
+void refreshProfile (int temp)
+{
+    unsigned long now = getUptime();
+
+    if (resumed) {
+        setpoint = soaking ? target : temp;
+        resumed = false;
+    }
+
+    while (running && lastSecond != now) {
+        lastSecond++;
+        nextProfileSecond (temp);
+    }
+}
+
+/**
+ * @brief Gets the setpoint of the thermostat.
+ * @return the setpoint of the program when it is running, otherwise
+ *  PARAM_THRESHOLD, in fine units.
+ */
+int getProfileSetpoint()
+{
+    if (running) {
+        return setpoint;
+    }
+
+    return getParamById (PARAM_THRESHOLD) << ADC_FINE_BITS;
+}
+
+/**
+ * @brief Checks the program to be running.
+ */
+bool isProfile()
+{
+    return running;
+}
+
+/**
+ * @brief Gets the index of the current step.
+ */
+unsigned char getProfileStep()
+{
+    return step;
+}
+
+/**
+ * @brief Gets the remaining hold time of the current step.
+ * @return minutes remaining, or PROFILE_NOT_SOAKING while the setpoint
+ *  or the temperature is still moving to the target.
+ */
+unsigned int getProfileRemaining()
+{
+    if (!soaking) {
+        return PROFILE_NOT_SOAKING;
+    }
+
+    return (holdRemaining + 59) / 60;
+}
+
+/**
+ * @brief Constructs the string of a hold time for the display: h.mm with
+ *  both digits of the minutes ("0.05"), or hours only from 10 hours on
+ *  ("12H"), which do not fit three digits as h.mm.
+ * @param minutes
+ *  the hold time, see getProfileRemaining().
+ * @param str
+ *  buffer of at least 5 characters.
+ */
+void holdToString (unsigned int minutes, unsigned char* str)
+{
+    unsigned char hours = minutes / 60;
+
+    if (hours < 10) {
+        minutes %= 60;
+        str[0] = '0' + hours;
+        str[1] = '.';
+        str[2] = '0' + minutes / 10;
+        str[3] = '0' + minutes % 10;
+        str[4] = 0;
+        return;
+    }
+
+    if (hours > 99) {
+        hours = 99;
+    }
+
+    str[0] = '0' + hours / 10;
+    str[1] = '0' + hours % 10;
+    str[2] = 'H';
+    str[3] = 0;
+}
@@ -17,25 +17,560 @@
 
 /**
  * Control functions for relay.
+ * Two control modes are selected by PARAM_CONTROL_MODE: the thermostat with
+ * hysteresis, and the PID controller (see pid.c) driving the relay as a
+ * time-proportional output. In the latter the relay is active for the
+ * first duty percent of every RELAY_WINDOW_SECONDS window; the output is
+ * switched on the timer ticks, so the duty has a 1% resolution.
+ * The setpoint is PARAM_THRESHOLD or the one of the running fermentation
+ * profile (see profile.c).
+ * The auto-tuning mode switches the relay fully on and off around the
+ * setpoint until the PID parameters are found; an aborted run disables
+ * the thermostat.
+ *
+ * Thermal model: while the thermostat works with hysteresis, a first order
+ * plus dead time model of the vessel is learned from the switching events,
+ * dt/ds = (K * u(s - L) - (t - A)) / T:
+ *  - dead time L: from the heater switch-off to the temperature peak;
+ *  - time constant T: from the decrease of the heating slope with the
+ *    temperature during a long heating, d(dt/ds)/dt = -1/T;
+ *  - ambient temperature A: from the cooling slope once the heater has
+ *    been off for longer than the dead time;
+ *  - gain K: the steady-state rise at full power, from the heating slope
+ *    before the switch-off.
+ * Slopes are taken over MODEL_SLOPE_SECONDS, every measurement is averaged
+ * into the model with the weight of 1/4.
+ * The predictive mode is the hysteresis thermostat fed with the temperature
+ * expected one dead time ahead: the cooling over L plus the heat already
+ * given during the last L, which has not reached the sensor yet. So the
+ * heater is switched off before the peak and on before the trough.
+ * The model is stored into EEPROM when the thermostat is disabled.
+ * Record layout (MODEL_SIZE bytes):
+ * |--L (s, 16 bits)--|--T (s, 16 bits)--|--K (C)--|--A (C)--|--Check--|
+ * 0                  2                  4         5         6
+ *
+ * Supervisor: the controllers only set the demanded state of the relay,
+ * it is switched on the timer ticks once the relay has been in its current
+ * state for the minimum on time (PARAM_RELAY_MIN_ON_TIME) or off time
+ * (PARAM_RELAY_MIN_OFF_TIME). A short pulse of the PID output is extended,
+ * the integral makes up for it. The disabled thermostat and the protection
+ * switch the relay off at once.
+ * The supervisor also counts the wear of the relay: the number of switch-ons,
+ * the total on time and the longest run. The statistics are stored every
+ * STATS_PERIOD seconds while the thermostat works and when it is disabled,
+ * alternately into STATS_SLOTS slots, so a power loss during programming
+ * leaves the previous record valid. The counters only grow, so the valid
+ * slot with the greater ones is the newer.
+ * Record layout (STATS_SIZE bytes):
+ * |--Cycles (32 bits)--|--On time (s, 32 bits)--|--Longest (s, 16 bits)--|--Check--|
+ * 0                    4                        8                        10
  */
 
 #include "relay.h"
 #include "stm8s003/gpio.h"
+#include "stm8s003/timer.h"
 #include "adc.h"
+#include "pid.h"
+#include "profile.h"
 #include "timer.h"
 #include "params.h"
 
+#define INTERRUPT_ENABLE        __asm rim __endasm;
+#define INTERRUPT_DISABLE       __asm sim __endasm;
 #define RELAY_PORT              PA_ODR
 #define RELAY_BIT               0x08
-#define RELAY_TIMER_MULTIPLIER  7
 #define RELAY_BUZZ_OFF_PULSES   6000
 #define RELAY_PRE_BUZZ_PULSES   10
 #define RELAY_BUZZ_ON_PULSES    60
+#define RELAY_WINDOW_TICKS      (RELAY_WINDOW_SECONDS * TICKS_IN_SECOND)
+#define MODEL_SIZE              7
+#define MODEL_SAMPLES           4       // Temperature history for the slope
+#define MODEL_SAMPLE_SECONDS    8
+#define MODEL_SLOPE_SECONDS     (MODEL_SAMPLES * MODEL_SAMPLE_SECONDS)
+#define MODEL_DEGREE            (10 << ADC_FINE_BITS)       // Fine units
+#define MODEL_PEAK_DROP         (MODEL_DEGREE / 10)
+#define MODEL_MIN_RISE          MODEL_DEGREE
+#define STATS_SLOTS             2
+#define STATS_SIZE              11
+#define STATS_PERIOD            3600    // Seconds between records while working
+#define MODEL_BYTE(offset)      EEPROM_BYTE (EEPROM_MODEL_OFFSET + (offset) )
+#define STATS_BYTE(offset)      EEPROM_BYTE (EEPROM_STATS_OFFSET + (offset) )
 
-static unsigned int timer;
 static unsigned int pulses;
 static bool state;
 static bool relayEnable;
+/* Time-proportional output, the counters are in timer ticks. */
+static bool window;
+static bool tuning;
+static bool windowStart;
+static unsigned int windowTicks;
+static unsigned int windowOnTicks;
+/* Thermal model, see above. Temperatures and slopes are in fine units,
+   slopes per MODEL_SLOPE_SECONDS, times in seconds. */
+static unsigned int deadTime;     // Delay of the peak, never negative
+static int timeConstant;
+static int gain;
+static int ambient;
+static bool modelChanged;
+static int history[MODEL_SAMPLES];
+static unsigned char historyPos;
+static unsigned long lastSample;
+static int slope;
+static bool learning;
+static bool heating;
+static unsigned long switchTime;
+static unsigned int onDuration;
+static bool peakWatch;
+static int peak;
+static unsigned long peakTime;
+static int maxSlope;
+static int maxSlopeTemp;
+static bool heatSettled;
+static int heatSlope;
+static int heatTemp;
+static bool coolWatch;
+/* Supervisor, the output is switched by buzzRelay(). */
+static bool driven;                 // The output follows the demand
+static bool demand;                 // Relay is wanted to be active
+static bool output;                 // Relay is active
+static unsigned int outputTicks;
+static unsigned int outputSeconds;  // Time in the current state, saturated
+/* Wear statistics. */
+static unsigned long statCycles;
+static unsigned long statOnTime;
+static unsigned int statLongest;
+static unsigned char statSlot;
+static unsigned char statClear;     // Slots still to be written after a reset
+static unsigned long statTime;
+static unsigned char statRecord[STATS_SIZE];
+
+/**
+ * @brief Loads the thermal model from EEPROM.
+ */
+static void initModel()
+{
+    unsigned char record[MODEL_SIZE], i;
+
+    for (i = 0; i < MODEL_SIZE; i++) {
+        record[i] = MODEL_BYTE (i);
+    }
+
+    deadTime = 0;
+    timeConstant = 0;
+    gain = 0;
+    ambient = 0;
+    modelChanged = false;
+    historyPos = 0;
+    slope = 0;
+    learning = false;
+
+    if (record[MODEL_SIZE - 1] == checkRecord (record, MODEL_SIZE) ) {
+        deadTime = (record[0] << 8) | record[1];
+        timeConstant = (record[2] << 8) | record[3];
+        gain = record[4] * MODEL_DEGREE;
+        ambient = (signed char) record[5] * MODEL_DEGREE;
+    }
+}
+
+/**
+ * @brief Stores the thermal model into EEPROM if it has been changed.
+ *  Retried on the next call while another record is being written.
+ */
+static void storeModel()
+{
+    static unsigned char record[MODEL_SIZE];
+
+    if (!modelChanged || !isRecordStored() ) {
+        return;
+    }
+
+    record[0] = deadTime >> 8;
+    record[1] = deadTime;
+    record[2] = timeConstant >> 8;
+    record[3] = timeConstant;
+    record[4] = getModelGain();
+    record[5] = getModelAmbient();
+    record[6] = checkRecord (record, MODEL_SIZE);
+    storeRecord (EEPROM_MODEL_OFFSET, record, MODEL_SIZE);
+    modelChanged = false;
+}
+
+/**
+ * @brief Averages a new measurement into a value of the model.
+ * @param val
+ *  the value of the model.
+ * @param meas
+ *  the new measurement, limited to the int range.
+ * @param known
+ *  false if the value has not been learned yet.
+ * @return the updated value.
+ */
+static int averageModel (int val, long meas, bool known)
+{
+    modelChanged = true;
+
+    if (meas > 32767) {
+        meas = 32767;
+    } else if (meas < -32767) {
+        meas = -32767;
+    }
+
+    if (!known) {
+        return meas;
+    }
+
+    return val + (meas - val) / 4;
+}
+
+/**
+ * @brief Learns the thermal model from the temperature and the heater
+ *  state. Called on every refresh of the thermostat with hysteresis.
+ * @param temp
+ *  the measured temperature in fine units.
+ * @param on
+ *  true while the heater is on.
+ */
+static void learnModel (int temp, bool on)
+{
+    unsigned long now = getUptime();
+    unsigned char i;
+    long val;
+
+    // The thermostat has just started: no switching event to learn from.
+    if (!learning) {
+        for (i = 0; i < MODEL_SAMPLES; i++) {
+            history[i] = temp;
+        }
+
+        lastSample = now;
+        switchTime = now;
+        onDuration = 0;
+        peakWatch = false;
+        coolWatch = false;
+        heatSettled = false;
+        maxSlope = -32767;
+        heating = on;
+        learning = true;
+    }
+
+    // Slope over the history of MODEL_SAMPLES samples.
+    if (now - lastSample >= MODEL_SAMPLE_SECONDS) {
+        lastSample = now;
+        slope = temp - history[historyPos];
+        history[historyPos] = temp;
+        historyPos = (historyPos + 1) % MODEL_SAMPLES;
+    }
+
+    if (on && !heating) {
+        // Heater is switched on.
+        switchTime = now;
+        peakWatch = false;
+        coolWatch = false;
+        maxSlope = -32767;
+    } else if (!on && heating) {
+        // Heater is switched off. The steepest heating slope was reached
+        // once the dead time had passed; it decreases with the temperature
+        // by 1/T.
+        onDuration = now - switchTime;
+
+        if (temp - maxSlopeTemp >= MODEL_MIN_RISE && maxSlope > slope) {
+            val = (long) (temp - maxSlopeTemp) * MODEL_SLOPE_SECONDS / (maxSlope - slope);
+            timeConstant = averageModel (timeConstant, val, timeConstant > 0);
+        }
+
+        heatSettled = deadTime > 0 && onDuration > deadTime + MODEL_SLOPE_SECONDS;
+        heatSlope = slope;
+        heatTemp = temp;
+        switchTime = now;
+        peak = temp;
+        peakTime = now;
+        // After a short pulse the peak is not delayed by the dead time.
+        peakWatch = onDuration > deadTime + MODEL_SLOPE_SECONDS;
+        coolWatch = true;
+    } else if (on) {
+        if (now - switchTime > MODEL_SLOPE_SECONDS && slope > maxSlope) {
+            maxSlope = slope;
+            maxSlopeTemp = temp;
+        }
+    } else {
+        if (peakWatch) {
+            if (temp > peak) {
+                peak = temp;
+                peakTime = now;
+            } else if (temp < peak - MODEL_PEAK_DROP) {
+                deadTime = averageModel (deadTime, peakTime - switchTime, deadTime > 0);
+                peakWatch = false;
+            }
+        }
+
+        // Pure cooling: dt/ds = -(t - A) / T gives the ambient, then the
+        // heating slope before the switch-off gives the gain.
+        if (coolWatch && !peakWatch && timeConstant > 0
+                && now - switchTime > deadTime + MODEL_SLOPE_SECONDS) {
+            val = temp + (long) slope * timeConstant / MODEL_SLOPE_SECONDS;
+            ambient = averageModel (ambient, val, ambient != 0);
+
+            if (heatSettled) {
+                val = heatTemp - ambient + (long) heatSlope * timeConstant / MODEL_SLOPE_SECONDS;
+                gain = averageModel (gain, val, gain > 0);
+            }
+
+            coolWatch = false;
+        }
+    }
+
+    heating = on;
+}
+
+/**
+ * @brief Predicts the temperature one dead time ahead: the cooling to the
+ *  ambient plus the heat given during the last dead time.
+ * @param temp
+ *  the measured temperature in fine units.
+ * @return the predicted temperature in fine units, or the measured one
+ *  while the model is not learned.
+ */
+static int predictTemperature (int temp)
+{
+    unsigned long elapsed = getUptime() - switchTime;
+    long heated;
+
+    if (deadTime == 0 || timeConstant == 0 || gain <= 0) {
+        return temp;
+    }
+
+    // Seconds of the last dead time with the heater on.
+    if (heating) {
+        heated = elapsed < deadTime ? elapsed : deadTime;
+    } else if (elapsed < deadTime) {
+        heated = deadTime - elapsed;
+
+        if (heated > onDuration) {
+            heated = onDuration;
+        }
+    } else {
+        heated = 0;
+    }
+
+    return temp + ( (long) gain * heated - (long) (temp - ambient) * deadTime) / timeConstant;
+}
+
+/**
+ * @brief Gets the dead time of the thermal model.
+ * @return seconds, 0 if not learned yet.
+ */
+unsigned int getModelDeadTime()
+{
+    return deadTime;
+}
+
+/**
+ * @brief Gets the time constant of the thermal model.
+ * @return seconds, 0 if not learned yet.
+ */
+unsigned int getModelTimeConstant()
+{
+    return timeConstant;
+}
+
+/**
+ * @brief Gets the gain of the thermal model.
+ * @return steady-state rise at full power in degrees, 0 if not learned yet.
+ */
+unsigned char getModelGain()
+{
+    if (gain <= 0) {
+        return 0;
+    }
+
+    return (gain + MODEL_DEGREE / 2) / MODEL_DEGREE;
+}
+
+/**
+ * @brief Gets the ambient temperature of the thermal model.
+ * @return degrees, 0 if not learned yet.
+ */
+signed char getModelAmbient()
+{
+    return ambient / MODEL_DEGREE;
+}
+
+/**
+ * @brief Reads the record of the wear statistics from a slot.
+ * @param slot
+ *  the slot number.
+ * @param record
+ *  buffer of STATS_SIZE bytes.
+ * @return true if the record is valid.
+ */
+static bool loadStats (unsigned char slot, unsigned char* record)
+{
+    unsigned char i;
+
+    for (i = 0; i < STATS_SIZE; i++) {
+        record[i] = STATS_BYTE (slot * STATS_SIZE + i);
+    }
+
+    return record[STATS_SIZE - 1] == checkRecord (record, STATS_SIZE);
+}
+
+/**
+ * @brief Makes the record of the current wear statistics.
+ * @param record
+ *  buffer of STATS_SIZE bytes.
+ */
+static void makeStats (unsigned char* record)
+{
+    unsigned long cycles, onTime;
+    unsigned int longest;
+
+    TIM4_IER = 0x00;    // The counters are updated by the update interrupt
+    cycles = statCycles;
+    onTime = statOnTime;
+    longest = statLongest;
+    TIM4_IER = 0x01;
+
+    record[0] = cycles >> 24;
+    record[1] = cycles >> 16;
+    record[2] = cycles >> 8;
+    record[3] = cycles;
+    record[4] = onTime >> 24;
+    record[5] = onTime >> 16;
+    record[6] = onTime >> 8;
+    record[7] = onTime;
+    record[8] = longest >> 8;
+    record[9] = longest;
+    record[10] = checkRecord (record, STATS_SIZE);
+}
+
+/**
+ * @brief Loads the newer valid record of the wear statistics from EEPROM.
+ */
+static void initStats()
+{
+    unsigned char record[STATS_SIZE], slot;
+    unsigned long cycles, onTime;
+
+    statCycles = 0;
+    statOnTime = 0;
+    statLongest = 0;
+    statSlot = 0;
+    statClear = 0;
+    statTime = getUptime();
+
+    for (slot = 0; slot < STATS_SLOTS; slot++) {
+        if (!loadStats (slot, record) ) {
+            continue;
+        }
+
+        cycles = ( (unsigned long) record[0] << 24) | ( (unsigned long) record[1] << 16)
+                 | ( (unsigned int) record[2] << 8) | record[3];
+        onTime = ( (unsigned long) record[4] << 24) | ( (unsigned long) record[5] << 16)
+                 | ( (unsigned int) record[6] << 8) | record[7];
+
+        if (cycles + onTime >= statCycles + statOnTime) {
+            statCycles = cycles;
+            statOnTime = onTime;
+            statLongest = (record[8] << 8) | record[9];
+            statSlot = slot;
+        }
+    }
+}
+
+/**
+ * @brief Stores the wear statistics into the next slot, unless they have
+ *  not changed since the last record. Retried on the next call while
+ *  another record is being written.
+ */
+static void storeStats()
+{
+    unsigned char i;
+
+    if (!isRecordStored() ) {
+        return;
+    }
+
+    statTime = getUptime();
+    makeStats (statRecord);
+
+    if (statClear > 0) {
+        statClear--;
+    } else {
+        for (i = 0; i < STATS_SIZE; i++) {
+            if (STATS_BYTE (statSlot * STATS_SIZE + i) != statRecord[i]) {
+                break;
+            }
+        }
+
+        if (i == STATS_SIZE) {
+            return;
+        }
+    }
+
+    statSlot = (statSlot + 1) % STATS_SLOTS;
+    storeRecord (EEPROM_STATS_OFFSET + statSlot * STATS_SIZE, statRecord, STATS_SIZE);
+}
+
+/**
+ * @brief Clears the wear statistics, e.g. after the relay is replaced.
+ *  The records are written by the following refreshes of the relay.
+ */
+void resetRelayStats()
+{
+    TIM4_IER = 0x00;
+    statCycles = 0;
+    statOnTime = 0;
+    statLongest = 0;
+    TIM4_IER = 0x01;
+
+    // Both slots, otherwise the older record would be taken as the newer.
+    statClear = STATS_SLOTS;
+}
+
+/**
+ * @brief Gets the number of switch-ons of the relay.
+ * @return the number of cycles.
+ */
+unsigned long getRelayCycles()
+{
+    unsigned long val;
+
+    TIM4_IER = 0x00;
+    val = statCycles;
+    TIM4_IER = 0x01;
+
+    return val;
+}
+
+/**
+ * @brief Gets the total time of the relay being active.
+ * @return seconds.
+ */
+unsigned long getRelayOnTime()
+{
+    unsigned long val;
+
+    TIM4_IER = 0x00;
+    val = statOnTime;
+    TIM4_IER = 0x01;
+
+    return val;
+}
+
+/**
+ * @brief Gets the longest continuous run of the relay.
+ * @return seconds, saturated at 65535.
+ */
+unsigned int getRelayLongestRun()
+{
+    unsigned int val;
+
+    TIM4_IER = 0x00;
+    val = statLongest;
+    TIM4_IER = 0x01;
+
+    return val;
+}
 
 /**
  * @brief Configure appropriate bits for GPIO port A, reset local timer
@@ -45,9 +580,17 @@ void initRelay()
 {
     PA_DDR |= RELAY_BIT;
     PA_CR1 |= RELAY_BIT;
-    timer = 0;
     state = false;
     relayEnable = true;
+    window = false;
+    tuning = false;
+    driven = false;
+    demand = false;
+    output = false;
+    outputTicks = 0;
+    outputSeconds = 0;
+    initModel();
+    initStats();
 }
 
 /**
@@ -72,12 +615,83 @@ static void switchRelay ()
     RELAY_PORT ^= RELAY_BIT;
 }
 
+/**
+ * @brief Switches the relay to the demanded state once the minimum on or
+ *  off time has passed and counts the wear statistics. Called on every tick.
+ */
+static void superviseRelay()
+{
+    // Both minimum times are limited to 0 ... 999 by the parameters.
+    unsigned int minSeconds = getParamById (output ? PARAM_RELAY_MIN_ON_TIME
+                                            : PARAM_RELAY_MIN_OFF_TIME);
+
+    if (++outputTicks >= TICKS_IN_SECOND) {
+        outputTicks = 0;
+
+        if (outputSeconds < 0xFFFF) {
+            outputSeconds++;
+        }
+
+        if (output) {
+            statOnTime++;
+
+            if (outputSeconds > statLongest) {
+                statLongest = outputSeconds;
+            }
+        }
+    }
+
+    if (demand != output && outputSeconds >= minSeconds) {
+        output = demand;
+        outputTicks = 0;
+        outputSeconds = 0;
+
+        if (output) {
+            statCycles++;
+        }
+    }
+
+    setRelay (output != getParamById (PARAM_RELAY_MODE) );
+}
+
+/**
+ * @brief Puts the relay into its inactive state at once and stops the
+ *  supervisor. The minimum off time is counted from here.
+ */
+static void releaseRelay()
+{
+    driven = false;
+    window = false;
+    demand = false;
+
+    if (output) {
+        output = false;
+        outputTicks = 0;
+        outputSeconds = 0;
+    }
+
+    setRelay (getParamById (PARAM_RELAY_MODE) );
+}
+
 /**
  * @brief Makes periodic buzz using relay when called on every tick.
+ *  Also switches the time-proportional output when it is active and
+ *  runs the supervisor.
  */
 void buzzRelay ()
 {
-    if (!isRelayEnabled() ) {
+    if (window) {
+        if (++windowTicks >= RELAY_WINDOW_TICKS) {
+            windowTicks = 0;
+            windowStart = true;
+        }
+
+        demand = windowTicks < windowOnTicks;
+    }
+
+    if (driven) {
+        superviseRelay();
+    } else if (!isRelayEnabled() ) {
         pulses++;
 
         if (pulses > (RELAY_BUZZ_OFF_PULSES + RELAY_PRE_BUZZ_PULSES + RELAY_BUZZ_ON_PULSES) ) {
@@ -98,6 +712,49 @@ void buzzRelay ()
     }
 }
 
+/**
+ * @brief Puts the relay into its inactive state immediately.
+ *  Used by the over-temperature protection from the ADC interrupt.
+ */
+void forceRelayOff()
+{
+    releaseRelay();
+}
+
+/**
+ * @brief Sets the duty of the time-proportional output.
+ * @param duty
+ *  in percent, 0 ... 100.
+ */
+static void setWindowDuty (unsigned char duty)
+{
+    TIM4_IER = 0x00;    // The window is switched by the update interrupt
+    windowOnTicks = duty * (RELAY_WINDOW_TICKS / 100);
+    TIM4_IER = 0x01;
+}
+
+/**
+ * @brief Runs the PID controller once per window of the time-proportional
+ *  output. The first window starts at once.
+ * @param threshold
+ *  the setpoint in fine units.
+ * @param temp
+ *  the measured temperature in fine units.
+ */
+static void refreshWindow (int threshold, int temp)
+{
+    if (!window) {
+        resetPID();
+        setWindowDuty (computePID (threshold, temp) );
+        windowTicks = 0;
+        windowStart = false;
+        window = true;
+    } else if (windowStart) {
+        windowStart = false;
+        setWindowDuty (computePID (threshold, temp) );
+    }
+}
+
 /**
  * @brief Enables relay functionality.
  * @param state
@@ -117,47 +774,126 @@ bool isRelayEnabled()
 }
 
 /**
- * @brief This function is being called during timer's interrupt
- *  request so keep it extremely small and fast.
+ * @brief Runs the auto-tuning of the PID parameters.
+ * @param threshold
+ *  the setpoint in fine units.
+ * @param temp
+ *  the measured temperature in fine units.
+ */
+static void refreshTuning (int threshold, int temp)
+{
+    if (!tuning) {
+        startAutotune();
+        tuning = true;
+    }
+
+    switch (refreshAutotune (threshold, temp) ) {
+    case AUTOTUNE_ON:
+        demand = true;
+        break;
+
+    case AUTOTUNE_OFF:
+        demand = false;
+        break;
+
+    case AUTOTUNE_FAILED:
+        enableRelay (false);
+        // Continue with the finished tuning (no break)
+    default:
+        tuning = false;
+        demand = false;
+    }
+}
+
+/**
+ * @brief Runs the thermostat once. Posted by the timer every 256 ticks
+ *  (EVENT_REFRESH_RELAY) and called from runEvents() in the main loop, so
+ *  it may take longer than a tick: the end of the auto-tuning stores the
+ *  parameters with storeParams(), which programs EEPROM in a burst, and
+ *  the model and statistics records are queued from here.
+ *  Comparison is done with the extended resolution temperature, so the
+ *  hysteresis is applied in steps of 1/80 degree without truncation.
  */
 void refreshRelay()
 {
-    bool mode = getParamById (PARAM_RELAY_MODE);
+    int temp = getTemperatureFine();
+    int control = temp;
+    int threshold;
+    int hysteresis = getParamById (PARAM_RELAY_HYSTERESIS) << (ADC_FINE_BITS - 3);
+    bool safe;
+
+    // The fermentation is over: switch the thermostat off.
+    if (isFTimer() && getFTimerRemaining() == 0) {
+        stopFTimer();
+        enableRelay (false);
+    }
 
+    // The profile is stopped together with the thermostat.
     if (!isRelayEnabled() ) {
-        setRelay (mode);
+        stopProfile();
+        storeModel();
+    }
+
+    if (!isRelayEnabled() || statClear > 0 || getUptime() - statTime >= STATS_PERIOD) {
+        storeStats();
+    }
+
+    refreshProfile (temp);
+    threshold = getProfileSetpoint();
+
+    // Keep the relay inactive while the over-temperature protection is on
+    // or the sensor fault is latched. The ADC interrupt releases the relay
+    // when they trip, so the latches are checked and the supervisor is
+    // started with all interrupts masked, otherwise the supervisor could
+    // be restarted right after the release.
+    INTERRUPT_DISABLE;
+    safe = isRelayEnabled() && getAdcWatchdog() != ADC_WATCHDOG_OVER
+           && getSensorFault() == ADC_SENSOR_OK;
+
+    if (safe) {
+        driven = true;
+    } else {
+        releaseRelay();
+    }
+
+    INTERRUPT_ENABLE;
+
+    if (!safe) {
+        tuning = false;
+        learning = false;
+        return;
+    }
+
+    if (getParamById (PARAM_CONTROL_MODE) == CONTROL_MODE_AUTOTUNE) {
+        window = false;
+        learning = false;
+        refreshTuning (threshold, temp);
         return;
     }
 
+    tuning = false;
+
+    if (getParamById (PARAM_CONTROL_MODE) == CONTROL_MODE_PID) {
+        learning = false;
+        refreshWindow (threshold, temp);
+        return;
+    }
+
+    window = false;
+
+    // The predictive mode switches one dead time earlier.
+    if (getParamById (PARAM_CONTROL_MODE) == CONTROL_MODE_PREDICTIVE) {
+        control = predictTemperature (temp);
+    }
+
     if (state) { // Relay state is enabled
-        if (getTemperature() < (getParamById (PARAM_THRESHOLD)
-                                - (getParamById (PARAM_RELAY_HYSTERESIS) >> 3) ) ) {
-            timer++;
-
-            if ( (getParamById (PARAM_RELAY_DELAY) << RELAY_TIMER_MULTIPLIER) < timer) {
-                state = false;
-                setRelay (!mode);
-            } else {
-                setRelay (mode);
-            }
-        } else {
-            timer = 0;
-            setRelay (mode);
-        }
-    } else { // Relay state is disabled
-        if (getTemperature() > (getParamById (PARAM_THRESHOLD)
-                                + (getParamById (PARAM_RELAY_HYSTERESIS) >> 3) ) ) {
-            timer++;
-
-            if ( (getParamById (PARAM_RELAY_DELAY) << RELAY_TIMER_MULTIPLIER) < timer) {
-                state = true;
-                setRelay (mode);
-            } else {
-                setRelay (!mode);
-            }
-        } else {
-            timer = 0;
-            setRelay (!mode);
+        if (control < (threshold - hysteresis) ) {
+            state = false;
         }
+    } else if (control > (threshold + hysteresis) ) { // Relay state is disabled
+        state = true;
     }
+
+    demand = !state;
+    learnModel (temp, output);
 }
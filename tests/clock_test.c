@@ -0,0 +1,177 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Host test of the digital clock correction of timer.c and the error
+ * calculation of calibration.c. The HSI is modelled by the number of
+ * timer ticks per second of the reference time:
+ *  - with a correction of N ppm set, a clock fast by N ppm has to count an
+ *    hour of the reference as 3600 seconds, for corrections up to the
+ *    limit of the calibration (20000 ppm, many ticks per second);
+ *  - a calibration over a whole number of hours of a clock fast by E ppm
+ *    has to store a correction of E ppm (or step the HSI trimming when E
+ *    is large), and the clock has to keep the time afterwards, also after
+ *    the correction is loaded back from EEPROM.
+ */
+
+#include <stdio.h>
+#include "adc.h"
+#include "calibration.h"
+#include "params.h"
+#include "stm8s003/clock.h"
+#include "stm8s003/prom.h"
+#include "timer.h"
+
+#define TEST_HOUR       3600UL
+#define TEST_TOLERANCE  1       // Seconds per hour
+
+unsigned char hostIo[HOST_IO_SIZE];
+static int failures;
+
+void buzzRelay() {}
+void postEvent (unsigned char event)
+{
+    (void) event;
+}
+void refreshDisplay() {}
+void requestADC() {}
+void updateAdcWatchdog() {}
+void boostClock() {}
+void releaseClock() {}
+bool getButton2()
+{
+    return false;
+}
+bool getButton3()
+{
+    return false;
+}
+
+unsigned char getClockShift()
+{
+    return 3;   // 2 MHz
+}
+
+unsigned char getSensorFault()
+{
+    return ADC_SENSOR_OK;
+}
+
+/**
+ * @brief Runs the timer for a time of the reference clock.
+ * @param seconds time of the reference clock.
+ * @param ppm error of the HSI, positive when fast.
+ */
+static void runClock (unsigned long seconds, long ppm)
+{
+    unsigned long n = (unsigned long) (seconds * TICKS_IN_SECOND * (1.0 + ppm / 1e6) + 0.5);
+
+    while (n-- > 0) {
+        TIM4_UPD_handler();
+    }
+}
+
+/**
+ * @brief Checks that an hour of the reference is counted as an hour.
+ */
+static void checkHour (const char* what, long ppm)
+{
+    unsigned long start = getUptime();
+    long counted;
+
+    runClock (TEST_HOUR, ppm);
+    counted = getUptime() - start;
+
+    if (counted < (long) TEST_HOUR - TEST_TOLERANCE || counted > (long) TEST_HOUR + TEST_TOLERANCE) {
+        printf ("%s, HSI %+ld ppm: %ld s counted in an hour\n", what, ppm, counted);
+        failures++;
+    }
+}
+
+/**
+ * @brief Calibrates against the reference and checks the result.
+ */
+static void checkCalibration (long ppm, unsigned char hours)
+{
+    unsigned char* record = &hostIo[EEPROM_BASE_ADDR - (unsigned long) hostIo
+                                    + EEPROM_CALIBRATION_OFFSET];
+    int stored;
+
+    record[0] = record[1] = record[2] = record[3] = 0;    // Factory trimming
+    initTimer();
+    startCalibration();
+    runClock (7, ppm);
+    markCalibration();
+    runClock (hours * TEST_HOUR, ppm);
+    markCalibration();
+
+    while (!isRecordStored() ) {
+        refreshRecord();
+    }
+
+    stored = (signed char) record[1] * 256 + record[2];
+
+    if (getCalibrationState() != CALIBRATION_OFF) {
+        printf ("calibration %+ld ppm: not finished\n", ppm);
+        failures++;
+    } else if (ppm > 10000 || ppm < -10000) {
+        // The HSI is trimmed one step towards the reference instead.
+        if ( (signed char) record[0] != (ppm > 0 ? -1 : 1) || stored != 0
+                || (CLK_HSITRIMR & 0x0F) != (record[0] & 0x0F) ) {
+            printf ("calibration %+ld ppm: trim %d, correction %d\n", ppm,
+                    (signed char) record[0], stored);
+            failures++;
+        }
+    } else {
+        if (stored < ppm - 1 || stored > ppm + 1) {
+            printf ("calibration %+ld ppm: correction %d\n", ppm, stored);
+            failures++;
+        }
+
+        checkHour ("calibrated", ppm);
+        initTimer();    // Loads the record back
+        checkHour ("reloaded", ppm);
+    }
+}
+
+int main (void)
+{
+    static const long corrections[] = {
+        0, 1, -1, 1999, -1999, 2000, -2000, 2001, 4500, -4500, 10000, -10000, 20000, -20000
+    };
+    static const long errors[] = {0, 50, -50, 700, -3000, 4500, 9999, -9999, 12000, -15000};
+    unsigned char i;
+
+    FLASH_IAPSR |= 0x40;    // EEPROM programming is always finished (HVOFF)
+
+    for (i = 0; i < sizeof corrections / sizeof corrections[0]; i++) {
+        initTimer();
+        setTimerCorrection (corrections[i]);
+        checkHour ("correction", corrections[i]);
+        checkHour ("correction", corrections[i]);
+    }
+
+    for (i = 0; i < sizeof errors / sizeof errors[0]; i++) {
+        checkCalibration (errors[i], 1 + i % 3);
+    }
+
+    printf ("clock: %u corrections, %u calibrations, %d failures\n",
+            (unsigned) (sizeof corrections / sizeof corrections[0]),
+            (unsigned) (sizeof errors / sizeof errors[0]), failures);
+
+    return failures != 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Host test of the adaptive averaging of adc.c (ADC_ADAPTIVE_FILTER)
+ * against the fixed 1/16 filter, on decimated 12-bit values which come
+ * every 512 ms:
+ *  - a step of 14 C (448 values) has to settle within 0.5 C at least
+ *    four times faster;
+ *  - the steady-state noise of the output, for a Gaussian input noise of
+ *    3 values, must not be more than 10% above the fixed filter.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include "../adc.c"
+
+#define TEST_PERIOD     0.512   // Seconds between decimated values
+#define TEST_LEVEL      1600    // About 40 C
+#define TEST_STEP       448     // 14 C
+#define TEST_BAND       16      // 0.5 C
+#define TEST_NOISE      3.0
+#define TEST_SETTLE     200     // Values after the step
+#define TEST_SAMPLES    100000  // Values for the noise
+
+unsigned char hostIo[HOST_IO_SIZE];
+
+int getParamById (unsigned char id)
+{
+    (void) id;
+    return 0;
+}
+
+void forceRelayOff() {}
+void resumeDisplay() {}
+
+unsigned char getClockShift()
+{
+    return 0;
+}
+
+static unsigned long fixed;
+
+/**
+ * @brief The fixed 1/16 filter, as built with ADC_ADAPTIVE_FILTER = 0.
+ */
+static void averageFixed (unsigned int sample)
+{
+    if (fixed == 0) {
+        fixed = (unsigned long) sample << ADC_AVERAGING_BITS;
+    } else {
+        fixed += sample - (fixed >> ADC_AVERAGING_BITS);
+    }
+}
+
+/**
+ * @brief Pseudo-random numbers independent of the C library.
+ * @return 0 ... 65535.
+ */
+static unsigned int random16()
+{
+    static unsigned long state = 12345;
+
+    state = state * 1103515245UL + 12345;
+
+    return (state >> 8) & 0xFFFF;
+}
+
+/**
+ * @brief Gaussian-like noise, sum of uniform numbers.
+ * @return a value with zero mean and the RMS of 1.
+ */
+static double noise()
+{
+    double sum = 0;
+    unsigned char i;
+
+    for (i = 0; i < 12; i++) {
+        sum += random16() / 65536.0;
+    }
+
+    return sum - 6;
+}
+
+/**
+ * @brief Feeds a value to both filters.
+ */
+static void feed (double val)
+{
+    unsigned int sample = (unsigned int) (val + 0.5);
+
+    averageSample (sample);
+    averageFixed (sample);
+}
+
+int main (void)
+{
+    double adaptiveSettle = 0, fixedSettle = 0, mean[2] = {0, 0}, square[2] = {0, 0};
+    double adaptiveNoise, fixedNoise, val;
+    unsigned long n;
+    int failures = 0;
+
+    // Step without noise: the time after which the output stays within
+    // the band around the new level.
+    averaged = fixed = 0;
+    feed (TEST_LEVEL);
+
+    for (n = 1; n <= TEST_SETTLE; n++) {
+        feed (TEST_LEVEL + TEST_STEP);
+
+        if (fabs ( (double) averaged / (1 << ADC_AVERAGING_BITS) - TEST_LEVEL - TEST_STEP) > TEST_BAND) {
+            adaptiveSettle = n * TEST_PERIOD;
+        }
+
+        if (fabs ( (double) fixed / (1 << ADC_AVERAGING_BITS) - TEST_LEVEL - TEST_STEP) > TEST_BAND) {
+            fixedSettle = n * TEST_PERIOD;
+        }
+    }
+
+    // Noise without a step.
+    averaged = fixed = 0;
+
+    for (n = 0; n < TEST_SAMPLES; n++) {
+        feed (TEST_LEVEL + TEST_NOISE * noise() );
+
+        if (n >= TEST_SETTLE) {
+            val = (double) averaged / (1 << ADC_AVERAGING_BITS);
+            mean[0] += val;
+            square[0] += val * val;
+            val = (double) fixed / (1 << ADC_AVERAGING_BITS);
+            mean[1] += val;
+            square[1] += val * val;
+        }
+    }
+
+    n = TEST_SAMPLES - TEST_SETTLE;
+    adaptiveNoise = sqrt (square[0] / n - (mean[0] / n) * (mean[0] / n) );
+    fixedNoise = sqrt (square[1] / n - (mean[1] / n) * (mean[1] / n) );
+
+    printf ("%d step settles within %d in %.1f s adaptive, %.1f s fixed\n",
+            TEST_STEP, TEST_BAND, adaptiveSettle, fixedSettle);
+    printf ("noise %.1f gives %.2f adaptive, %.2f fixed\n", TEST_NOISE, adaptiveNoise, fixedNoise);
+
+    if (adaptiveSettle * 4 > fixedSettle) {
+        printf ("adaptive filter settles too slowly\n");
+        failures++;
+    }
+
+    if (adaptiveNoise > fixedNoise * 1.1) {
+        printf ("adaptive filter is too noisy\n");
+        failures++;
+    }
+
+    printf ("ema: %d failures\n", failures);
+
+    return failures != 0;
+}
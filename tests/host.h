@@ -0,0 +1,32 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Host build of the firmware sources for the tests. The stm8s003 headers
+ * are generated from include/stm8s003 by the Makefile with every register
+ * turned into the byte of hostIo[] at its address, so the firmware code
+ * compiles unchanged and the tests can look at the registers.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#define HOST_IO_SIZE    0x5800  // Up to the last peripheral register
+
+extern unsigned char hostIo[HOST_IO_SIZE];
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Host test of the median prefilter of adc.c, built for 3 and 5 taps
+ * (ADC_MEDIAN_TAPS). The filter is checked against a sort:
+ *  - exhaustively, for every window of values 0 ... TEST_VALUES - 1, which
+ *    covers all orders and ties at every position of the ring buffer;
+ *  - on a long pseudo-random stream, against the last ADC_MEDIAN_TAPS
+ *    samples;
+ *  - for the first sample, which fills the whole buffer.
+ *
+ * Then a noisy trace with injected spikes is fed through the prefilter and
+ * the RMS and peak errors against the clean signal are printed with and
+ * without the median stage, for the raw samples and for the decimated
+ * 12-bit values which enter the averaging. Traces with single spikes and
+ * with pairs are used; the median has to lower both errors of the
+ * decimated values for spikes of up to (ADC_MEDIAN_TAPS - 1) / 2 samples,
+ * which it removes.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../adc.c"
+
+#define TEST_VALUES     6
+#define TEST_STREAM     100000
+#define TRACE_BLOCKS    2000        // Decimated values of the trace
+#define TRACE_NOISE     1.0         // RMS noise of the raw samples, LSB
+#define TRACE_SPIKES    100         // One sample in TRACE_SPIKES is a spike
+#define TRACE_SPIKE     200         // Maximal spike amplitude, LSB
+
+typedef struct {
+    double sum;
+    double peak;
+    unsigned long count;
+} Error;
+
+unsigned char hostIo[HOST_IO_SIZE];
+
+int getParamById (unsigned char id)
+{
+    (void) id;
+    return 0;
+}
+
+void forceRelayOff() {}
+void resumeDisplay() {}
+
+unsigned char getClockShift()
+{
+    return 0;
+}
+
+static int compare (const void* a, const void* b)
+{
+    return * (const unsigned int*) a - * (const unsigned int*) b;
+}
+
+/**
+ * @brief Pseudo-random numbers independent of the C library.
+ * @return 0 ... 65535.
+ */
+static unsigned int random16()
+{
+    static unsigned long state = 12345;
+
+    state = state * 1103515245UL + 12345;
+
+    return (state >> 8) & 0xFFFF;
+}
+
+/**
+ * @brief Gaussian-like noise, sum of uniform numbers.
+ * @return a value with zero mean and the RMS of 1.
+ */
+static double noise()
+{
+    double sum = 0;
+    unsigned char i;
+
+    for (i = 0; i < 12; i++) {
+        sum += random16() / 65536.0;
+    }
+
+    return sum - 6;
+}
+
+static void addError (Error* err, double val)
+{
+    err->sum += val * val;
+    err->count++;
+
+    if (fabs (val) > err->peak) {
+        err->peak = fabs (val);
+    }
+}
+
+static double rms (const Error* err)
+{
+    return sqrt (err->sum / err->count);
+}
+
+/**
+ * @brief Feeds the spiked trace through the prefilter and prints the
+ *  errors. The clean signal ramps slowly over a quarter of the range, as
+ *  a batch heats up, so the delay of the median (a sample or two) is far
+ *  below the noise.
+ * @param length
+ *  number of samples of a spike.
+ * @return number of failures.
+ */
+static int checkTrace (unsigned char length)
+{
+    Error rawSample = {0, 0, 0}, medSample = {0, 0, 0};
+    Error rawBlock = {0, 0, 0}, medBlock = {0, 0, 0};
+    unsigned int val, out, rawSum, medSum;
+    unsigned long n, block;
+    double clean, cleanSum;
+    unsigned char k, burst = 0;
+    int spike = 0;
+
+    windowPos = 0xFF;
+
+    for (block = 0; block < TRACE_BLOCKS; block++) {
+        rawSum = medSum = 0;
+        cleanSum = 0;
+
+        for (k = 0; k < (1 << ADC_OVERSAMPLING_BITS); k++) {
+            n = block * (1 << ADC_OVERSAMPLING_BITS) + k;
+            clean = 400 + 256.0 * n / (TRACE_BLOCKS * (1 << ADC_OVERSAMPLING_BITS) );
+
+            if (burst == 0 && random16() % TRACE_SPIKES == 0) {
+                burst = length;
+                spike = (int) (random16() % (2 * TRACE_SPIKE + 1) ) - TRACE_SPIKE;
+            }
+
+            val = (unsigned int) (clean + TRACE_NOISE * noise() + 0.5);
+
+            if (burst > 0) {
+                val += spike;
+                burst--;
+            }
+
+            out = filterSample (val);
+            rawSum += val;
+            medSum += out;
+            cleanSum += clean;
+
+            if (block > 0) {
+                addError (&rawSample, val - clean);
+                addError (&medSample, out - clean);
+            }
+        }
+
+        // Errors in 12-bit units, as the decimated value is used.
+        if (block > 0) {
+            addError (&rawBlock, (rawSum - cleanSum) / (1 << ADC_DECIMATION_SHIFT) );
+            addError (&medBlock, (medSum - cleanSum) / (1 << ADC_DECIMATION_SHIFT) );
+        }
+    }
+
+    printf ("%d taps, spikes of %d: samples RMS %.2f -> %.2f, peak %.0f -> %.0f LSB;"
+            " decimated RMS %.2f -> %.2f, peak %.2f -> %.2f (1/4 LSB)\n",
+            ADC_MEDIAN_TAPS, length, rms (&rawSample), rms (&medSample), rawSample.peak,
+            medSample.peak, rms (&rawBlock), rms (&medBlock), rawBlock.peak, medBlock.peak);
+
+    if (length <= (ADC_MEDIAN_TAPS - 1) / 2
+            && (rms (&medBlock) >= rms (&rawBlock) || medBlock.peak >= rawBlock.peak) ) {
+        printf ("spiked trace: the median does not lower the error\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Median of the samples by sorting.
+ */
+static unsigned int median (const unsigned int* samples)
+{
+    unsigned int sorted[ADC_MEDIAN_TAPS];
+    unsigned char i;
+
+    for (i = 0; i < ADC_MEDIAN_TAPS; i++) {
+        sorted[i] = samples[i];
+    }
+
+    qsort (sorted, ADC_MEDIAN_TAPS, sizeof sorted[0], compare);
+
+    return sorted[ADC_MEDIAN_TAPS / 2];
+}
+
+int main (void)
+{
+    unsigned int samples[ADC_MEDIAN_TAPS], val, out;
+    unsigned long n, count = 1, i;
+    unsigned char k;
+    int failures = 0;
+
+    for (k = 0; k < ADC_MEDIAN_TAPS; k++) {
+        count *= TEST_VALUES;
+    }
+
+    // Every window: the first sample fills the buffer, then the window
+    // replaces it completely.
+    for (n = 0; n < count; n++) {
+        for (k = 0, i = n; k < ADC_MEDIAN_TAPS; k++, i /= TEST_VALUES) {
+            samples[k] = i % TEST_VALUES;
+        }
+
+        windowPos = 0xFF;
+        filterSample (samples[0]);
+
+        for (k = 0; k < ADC_MEDIAN_TAPS; k++) {
+            out = filterSample (samples[k]);
+        }
+
+        if (out != median (samples) ) {
+            printf ("window %lu: %u instead of %u\n", n, out, median (samples) );
+            failures++;
+        }
+    }
+
+    // Long stream, wide values.
+    windowPos = 0xFF;
+    srand (1);
+
+    for (n = 0; n < TEST_STREAM; n++) {
+        val = rand() & 0x3FF;
+
+        if (n == 0) {
+            for (k = 0; k < ADC_MEDIAN_TAPS; k++) {
+                samples[k] = val;
+            }
+        } else {
+            samples[n % ADC_MEDIAN_TAPS] = val;
+        }
+
+        out = filterSample (val);
+
+        if (out != (n == 0 ? val : median (samples) ) ) {
+            printf ("stream %lu: %u instead of %u\n", n, out, median (samples) );
+            failures++;
+        }
+    }
+
+    failures += checkTrace (1);
+    failures += checkTrace (2);
+
+    printf ("median of %d taps: %lu windows, %d streamed samples, %d failures\n",
+            ADC_MEDIAN_TAPS, count, TEST_STREAM, failures);
+
+    return failures != 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Host test of profile.c:
+ *  - the hold time is shown as h.mm with both digits of the minutes below
+ *    10 hours, and as hours only above;
+ *  - the default program, with the temperature following the setpoint,
+ *    runs its steps and disables the thermostat after the holds.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "adc.h"
+#include "params.h"
+#include "profile.h"
+
+unsigned char hostIo[HOST_IO_SIZE];
+static unsigned long uptime;
+static bool relayEnabled;
+static int failures;
+
+unsigned long getUptime()
+{
+    return uptime;
+}
+
+int getTemperatureFine()
+{
+    return 200 << ADC_FINE_BITS;
+}
+
+unsigned char getSensorFault()
+{
+    return ADC_SENSOR_OK;
+}
+
+void enableRelay (bool state)
+{
+    relayEnabled = state;
+}
+
+int getParamById (unsigned char id)
+{
+    if (id == PARAM_MAX_TEMPERATURE) {
+        return 50;
+    } else if (id == PARAM_MIN_TEMPERATURE) {
+        return 20;
+    }
+
+    return 0;
+}
+
+unsigned char checkRecord (const unsigned char* data, unsigned char size)
+{
+    unsigned char i, sum = 0;
+
+    for (i = 0; i < size - 1; i++) {
+        sum += data[i];
+    }
+
+    return ~sum;
+}
+
+void storeRecord (unsigned char offset, const unsigned char* data, unsigned char size)
+{
+    memcpy (&EEPROM_BYTE (offset), data, size);
+}
+
+/**
+ * @brief Checks the display string of a hold time.
+ */
+static void checkHold (unsigned int minutes, const char* expected)
+{
+    unsigned char str[8];
+
+    holdToString (minutes, str);
+
+    if (strcmp ( (char*) str, expected) != 0) {
+        printf ("hold %u min: \"%s\" instead of \"%s\"\n", minutes, str, expected);
+        failures++;
+    }
+}
+
+/**
+ * @brief Runs the default program with the temperature following the
+ *  setpoint and checks the time it takes.
+ */
+static void checkProgram()
+{
+    int temp = 200 << ADC_FINE_BITS;
+    unsigned long end = 0;
+
+    initProfile();
+    uptime = 0;
+    startProfile();
+    relayEnabled = true;
+
+    // 43 C is set at once, then the holds of 15 minutes and 8 hours.
+    while (uptime < 10 * 3600UL && relayEnabled) {
+        uptime++;
+        refreshProfile (temp);
+        temp = getProfileSetpoint();
+
+        if (!relayEnabled) {
+            end = uptime;
+        }
+    }
+
+    if (relayEnabled || isProfile() || end < 8 * 3600UL + 15 * 60 || end > 8 * 3600UL + 15 * 60 + 10) {
+        printf ("default program: ended %d at %lu s\n", !relayEnabled, end);
+        failures++;
+    }
+}
+
+int main (void)
+{
+    checkHold (0, "0.00");
+    checkHold (5, "0.05");
+    checkHold (45, "0.45");
+    checkHold (60, "1.00");
+    checkHold (65, "1.05");
+    checkHold (599, "9.59");
+    checkHold (600, "10H");
+    checkHold (1275, "21H");
+    checkProgram();
+
+    printf ("profile: 8 holds, 1 program, %d failures\n", failures);
+
+    return failures != 0;
+}
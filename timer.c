@@ -24,36 +24,100 @@
 #include "stm8s003/clock.h"
 #include "stm8s003/timer.h"
 #include "adc.h"
+#include "calibration.h"
 #include "display.h"
+#include "events.h"
 #include "params.h"
+#include "power.h"
 #include "menu.h"
 #include "relay.h"
 
-#define TICKS_IN_SECOND     500
-#define BITS_FOR_TICKS      9
-#define BITS_FOR_SECONDS    6
-#define BITS_FOR_MINUTES    6
-#define BITS_FOR_HOURS      5
-#define BITS_FOR_DAYS       6
-#define SECONDS_FIRST_BIT   BITS_FOR_TICKS + 1
-#define MINUTES_FIRST_BIT   BITS_FOR_TICKS + BITS_FOR_SECONDS + 1
-#define HOURS_FIRST_BIT     BITS_FOR_TICKS + BITS_FOR_SECONDS + BITS_FOR_MINUTES + 1
-#define DAYS_FIRST_BIT      BITS_FOR_TICKS + BITS_FOR_SECONDS + BITS_FOR_MINUTES + BITS_FOR_HOURS + 1
-#define BITMASK(L)          ( ~ (0xFFFFFFFF << (L) ) )
-#define NBITMASK(L)         (0xFFFFFFFF << (L) )
+#define TIMER_CLOCK_SHIFT   7       // 16 MHz >> 7 = 125 kHz timer clock
 
 /**
- * Uptime counter
- * |--Day--|--Hour--|--Minute--|--Second--|--Ticks--|
- * 31      26       21         15         9         0
+ * Periodic tasks dispatched by TIM4_UPD_handler().
+ * Period and phase are in ticks (2 ms). The phases are chosen so that the
+ * tasks never fall on the same tick: with periods being multiples of 4 the
+ * phases 1, 2 and 3 give different residues modulo 4.
+ * Budget is the allowed run time in CPU cycles, including the indirect call
+ * and the reads of the counter. The run time is measured in TIM4 counts,
+ * which are 2^TIM4_PSCR CPU cycles at any clock (16 at 2 MHz, 128 at the
+ * boosted 16 MHz), so it is converted to cycles with the prescaler in use
+ * and one count is allowed for the resolution. A task running longer
+ * increments its overrun counter, the longest run is kept for checking
+ * the budgets on the device (getTaskLongest()). The budgets are estimated
+ * from the code of the tasks, a few dozen instructions each, with a margin
+ * of about two. Menu and relay work is only posted as an event and done
+ * later in main().
  */
-static unsigned long uptime;
+typedef struct {
+    void (*run) ();
+    unsigned int period;
+    unsigned int phase;
+    unsigned int budget;
+} Task;
+
+static void postMenuRefresh();
+static void postRelayRefresh();
+
+static const Task tasks[] = {
+    { postMenuRefresh, 16, 1, 160 },
+    { requestADC, ADC_START_MASK + 1, 2, 60 },
+    { postRelayRefresh, 256, 3, 160 }
+};
+
+#define TASKS_COUNT         (sizeof (tasks) / sizeof (tasks[0]) )
+
+/**
+ * Uptime counters. Ticks within the current second and the total number
+ * of seconds are binary counters; the second, minute, hour and day fields
+ * are kept separately and updated on the second's rollover only, so the
+ * getters are plain loads without divisions of 32-bit values. Seconds
+ * wrap after 136 years and days after 179 years.
+ * The counters are written by TIM4_UPD_handler(), so they are volatile:
+ * the readers have to load them between the two reads of timeSeq.
+ */
+static volatile unsigned int ticks;
+static volatile unsigned long seconds;
+static volatile unsigned char uptimeSeconds;
+static volatile unsigned char uptimeMinutes;
+static volatile unsigned char uptimeHours;
+static volatile unsigned int uptimeDays;
+static unsigned int bootCount;
+/**
+ * Digital correction of the HSI frequency error left after the trimming.
+ * The error in ppm is summed once per second; the whole ticks of the sum
+ * (1000000 / TICKS_IN_SECOND ppm each) make the next second longer (HSI is
+ * fast) or shorter (HSI is slow) and the remainder is carried over. So the
+ * sum stays within the correction plus one tick (see CALIBRATION_MAX_PPM).
+ */
+#define TICK_PPM            (1000000 / TICKS_IN_SECOND)
+
+static int correction;
+static int correctionSum;
+static unsigned int secondLength;
+/**
+ * Fermentation timer: seconds remaining and the same value split into
+ * hours, minutes and seconds for the display, counted down together once
+ * per second. The countdown does not run while paused or while a sensor
+ * fault is latched. An expired timer stays active with zero remaining
+ * until refreshRelay() stops it.
+ */
+static bool fTimer;
+static bool fTimerPaused;
+static volatile unsigned long fTimerRemaining;
+static volatile unsigned char fTimerHours;
+static volatile unsigned char fTimerMinutes;
+static volatile unsigned char fTimerSeconds;
 /**
- * |--Hour--|--Minute--|
- * 11       6          0
+ * Sequence number of the time counters, incremented by TIM4_UPD_handler()
+ * after every update. Readers outside of the interrupt repeat copying
+ * until it stays the same (see getTimeSnapshot()).
  */
-static unsigned int fTimer;
-static unsigned char fTimerSeconds;
+static volatile unsigned char timeSeq;
+static unsigned int taskCountdown[TASKS_COUNT];
+static unsigned char taskOverruns[TASKS_COUNT];
+static unsigned int taskLongest[TASKS_COUNT];
 
 /**
  * @brief Utility function. Appends characters from one string to the
@@ -78,26 +142,187 @@ static void strAppend (unsigned char * src, unsigned char * dst)
     dst[s + i] = 0;
 }
 
+/**
+ * @brief Loads the number of device starts from EEPROM and stores it
+ *  incremented. The counter stays zero when TIMER_BOOT_COUNTER is 0.
+ */
+static void countBoot()
+{
+#if TIMER_BOOT_COUNTER
+    static unsigned char record[2];
+
+    bootCount = (EEPROM_BYTE (EEPROM_BOOT_COUNT_OFFSET) << 8) | EEPROM_BYTE (EEPROM_BOOT_COUNT_OFFSET + 1);
+    bootCount++;
+    record[0] = bootCount >> 8;
+    record[1] = bootCount;
+    storeRecord (EEPROM_BOOT_COUNT_OFFSET, record, 2);
+#endif
+}
+
+/**
+ * @brief Gets the number of device starts, including the current one.
+ * @return boot counter, wraps after 65535.
+ */
+unsigned int getBootCount()
+{
+    return bootCount;
+}
+
 /**
  * @brief Initialize timer's configuration registers and reset uptime.
  */
 void initTimer()
 {
-    CLK_CKDIVR = 0x00;  // Set the frequency to 16 MHz
-    TIM4_PSCR = 0x07;   // CLK / 128 = 125KHz
-    TIM4_ARR = 0xF5;    // 125KHz /  250(0xFA) = 500Hz
+    unsigned char i;
+
+    correctionSum = 0;
+    secondLength = TICKS_IN_SECOND;
+    initCalibration();  // HSI trimming and the correction from EEPROM
+    TIM4_PSCR = TIMER_CLOCK_SHIFT - getClockShift();   // CLK / 2^n = 125KHz
+    TIM4_ARR = 0xF9;    // 125KHz /  250(0xF9 + 1) = 500Hz
     TIM4_IER = 0x01;    // Enable interrupt on update event
     TIM4_CR1 = 0x05;    // Enable timer
     resetUptime();
-    fTimer = 0;
+    stopFTimer();
+    countBoot();
+
+    for (i = 0; i < TASKS_COUNT; i++) {
+        taskCountdown[i] = tasks[i].phase;
+        taskOverruns[i] = 0;
+        taskLongest[i] = 0;
+    }
+}
+
+/**
+ * @brief Sets the digital correction of the tick frequency.
+ * @param ppm
+ *  error of the HSI frequency in ppm, positive when it runs fast.
+ *  Zero disables the correction.
+ */
+void setTimerCorrection (int ppm)
+{
+    TIM4_IER = 0x00;    // The value is used by the update interrupt
+    correction = ppm;
+    TIM4_IER = 0x01;
+}
+
+/**
+ * @brief Gets the number of times the task exceeded its time budget.
+ * @param id index of the task in the tasks table.
+ * @return amount of overruns, saturated at 255.
+ */
+unsigned char getTaskOverruns (unsigned char id)
+{
+    return taskOverruns[id];
+}
+
+/**
+ * @brief Gets the longest measured run time of the task.
+ * @param id index of the task in the tasks table.
+ * @return CPU cycles, rounded down to the resolution of the TIM4 counter.
+ */
+unsigned int getTaskLongest (unsigned char id)
+{
+    unsigned int val;
+
+    TIM4_IER = 0x00;    // The value is updated by the update interrupt
+    val = taskLongest[id];
+    TIM4_IER = 0x01;
+
+    return val;
+}
+
+/**
+ * @brief Defers the menu timing logic to main().
+ */
+static void postMenuRefresh()
+{
+    postEvent (EVENT_REFRESH_MENU);
+}
+
+/**
+ * @brief Defers the relay control to main().
+ */
+static void postRelayRefresh()
+{
+    postEvent (EVENT_REFRESH_RELAY);
 }
 
 /**
- * @brief Starts fermentation timer.
+ * @brief Runs every task whose countdown has expired and reloads the
+ *  countdown with the task's period. The run time is measured by the TIM4
+ *  counter, which keeps counting from the update event of this tick.
+ */
+static void runTasks()
+{
+    unsigned char i, start;
+    unsigned int spent;
+
+    for (i = 0; i < TASKS_COUNT; i++) {
+        if (--taskCountdown[i] != 0) {
+            continue;
+        }
+
+        taskCountdown[i] = tasks[i].period;
+        start = TIM4_CNTR;
+        tasks[i].run();
+        spent = (unsigned char) (TIM4_CNTR - start);
+        spent <<= TIM4_PSCR;
+
+        if (spent > taskLongest[i]) {
+            taskLongest[i] = spent;
+        }
+
+        if (spent > tasks[i].budget + (1 << TIM4_PSCR) && taskOverruns[i] < 0xFF) {
+            taskOverruns[i]++;
+        }
+    }
+}
+
+/**
+ * @brief Sets the TIM4 prescaler for the new CPU clock, so the timer keeps
+ *  counting at 125 kHz. The prescaler is reloaded at once by the update
+ *  generation (silent due to URS) and the counter is restored, so the
+ *  tick in progress keeps its length. Called with interrupts disabled.
+ * @param shift
+ *  the CPU clock is 16 MHz >> shift.
+ */
+void setTimerClock (unsigned char shift)
+{
+    unsigned char cnt = TIM4_CNTR;
+
+    TIM4_PSCR = TIMER_CLOCK_SHIFT - shift;
+    TIM4_EGR = 0x01;    // Update generation (UG)
+    TIM4_CNTR = cnt;
+}
+
+/**
+ * @brief Starts fermentation timer for the time set by the parameter.
  */
 void startFTimer()
 {
-    fTimer = ( (getParamById (PARAM_FERMENTATION_TIME) - 1) << BITS_FOR_MINUTES) + 59;
+    resumeFTimer ( (unsigned long) getParamById (PARAM_FERMENTATION_TIME) * 3600, false);
+}
+
+/**
+ * @brief Starts fermentation timer for the given remaining time, e.g. the
+ *  one restored after a power loss. The timer interrupt does not touch an
+ *  inactive timer, so the fields are set first and the timer is activated
+ *  last.
+ * @param remaining
+ *  number of seconds remaining.
+ * @param paused
+ *  true - start in paused state.
+ */
+void resumeFTimer (unsigned long remaining, bool paused)
+{
+    fTimer = false;
+    fTimerPaused = paused;
+    fTimerRemaining = remaining;
+    fTimerHours = (unsigned char) (remaining / 3600);
+    fTimerMinutes = (unsigned char) ( (remaining / 60) % 60);
+    fTimerSeconds = (unsigned char) (remaining % 60);
+    fTimer = true;
 }
 
 /**
@@ -105,7 +330,48 @@ void startFTimer()
  */
 void stopFTimer()
 {
-    fTimer = 0;
+    fTimer = false;
+    fTimerPaused = false;
+    fTimerRemaining = 0;
+    fTimerHours = 0;
+    fTimerMinutes = 0;
+    fTimerSeconds = 0;
+}
+
+/**
+ * @brief Pauses or resumes the countdown of the fermentation timer.
+ * @param val
+ *  true - pause, false - resume.
+ */
+void pauseFTimer (bool val)
+{
+    fTimerPaused = val;
+}
+
+/**
+ * @brief Checks fermentation timer to be paused by the user.
+ * @return True if the countdown is paused.
+ */
+bool isFTimerPaused()
+{
+    return fTimerPaused;
+}
+
+/**
+ * @brief Gets the time remaining until the end of fermentation.
+ * @return number of seconds, zero when the timer is expired or stopped.
+ */
+unsigned long getFTimerRemaining()
+{
+    unsigned char seq;
+    unsigned long val;
+
+    do {
+        seq = timeSeq;
+        val = fTimerRemaining;
+    } while (seq != timeSeq);
+
+    return val;
 }
 
 /**
@@ -114,7 +380,7 @@ void stopFTimer()
  */
 unsigned char getFTimerMinutes()
 {
-    return (unsigned char) (fTimer & BITMASK (BITS_FOR_MINUTES) );
+    return fTimerMinutes;
 }
 
 /**
@@ -123,7 +389,7 @@ unsigned char getFTimerMinutes()
  */
 unsigned char getFTimerHours()
 {
-    return (unsigned char) (fTimer >> BITS_FOR_MINUTES);
+    return fTimerHours;
 }
 
 /**
@@ -132,7 +398,7 @@ unsigned char getFTimerHours()
  */
 bool isFTimer()
 {
-    return fTimer != 0;
+    return fTimer;
 }
 
 /**
@@ -140,18 +406,54 @@ bool isFTimer()
  */
 void resetUptime()
 {
-    uptime = 0;
+    ticks = 0;
+    seconds = 0;
+    uptimeSeconds = 0;
+    uptimeMinutes = 0;
+    uptimeHours = 0;
+    uptimeDays = 0;
 }
 
 /**
- * @brief Gets raw value of bit-mapped uptime counter.
- * |--Day--|--Hour--|--Minute--|--Second--|--Ticks--|
- * 31      26       21         15         9         0
- * @return value of uptime counter.
+ * @brief Gets the number of seconds being passed since last reset.
+ * @return total amount of seconds.
  */
 unsigned long getUptime()
 {
-    return uptime;
+    unsigned char seq;
+    unsigned long val;
+
+    do {
+        seq = timeSeq;
+        val = seconds;
+    } while (seq != timeSeq);
+
+    return val;
+}
+
+/**
+ * @brief Makes a consistent copy of uptime and fermentation timer without
+ *  disabling interrupts. The copy is repeated if the timer interrupt
+ *  has updated the counters meanwhile.
+ * @param snap
+ *  Pointer to the structure to be filled.
+ */
+void getTimeSnapshot (TimeSnapshot* snap)
+{
+    unsigned char seq;
+
+    do {
+        seq = timeSeq;
+        snap->uptime = seconds;
+        snap->ticks = ticks;
+        snap->seconds = uptimeSeconds;
+        snap->minutes = uptimeMinutes;
+        snap->hours = uptimeHours;
+        snap->days = uptimeDays;
+        snap->fTimerRemaining = fTimerRemaining;
+        snap->fTimerHours = fTimerHours;
+        snap->fTimerMinutes = fTimerMinutes;
+    } while (seq != timeSeq);
 }
 
 /**
@@ -160,7 +462,7 @@ unsigned long getUptime()
  */
 unsigned int getUptimeTicks()
 {
-    return (unsigned int) (uptime & BITMASK (BITS_FOR_TICKS) );
+    return ticks;
 }
 
 /**
@@ -169,7 +471,7 @@ unsigned int getUptimeTicks()
  */
 unsigned char getUptimeSeconds()
 {
-    return (unsigned char) ( (uptime >> SECONDS_FIRST_BIT) & BITMASK (BITS_FOR_SECONDS) );
+    return uptimeSeconds;
 }
 
 /**
@@ -178,7 +480,7 @@ unsigned char getUptimeSeconds()
  */
 unsigned char getUptimeMinutes()
 {
-    return (unsigned char) ( (uptime >> MINUTES_FIRST_BIT) & BITMASK (BITS_FOR_MINUTES) );
+    return uptimeMinutes;
 }
 
 /**
@@ -187,16 +489,16 @@ unsigned char getUptimeMinutes()
  */
 unsigned char getUptimeHours()
 {
-    return (unsigned char) ( (uptime >> HOURS_FIRST_BIT) & BITMASK (BITS_FOR_HOURS) );
+    return uptimeHours;
 }
 
 /**
  * @brief Gets amount of days being passed since last reset.
  * @return amount of days.
  */
-unsigned char getUptimeDays()
+unsigned int getUptimeDays()
 {
-    return (unsigned char) ( (uptime >> DAYS_FIRST_BIT) & BITMASK (BITS_FOR_DAYS) );
+    return uptimeDays;
 }
 
 /**
@@ -212,19 +514,25 @@ unsigned char getUptimeDays()
  * as a separator.
  * Example: "dd.hH.MM" for 00 days, 10 hours and 02 minutes will produce
  * ".10.02" result.
+ * Days take up to five digits ("DDDDD"), other fields up to two.
  */
 void uptimeToString (unsigned char* strBuff, const unsigned char* format)
 {
-    unsigned char i, j, f[3], v;
+    unsigned char i, j, f[6];
+    unsigned int v;
+    TimeSnapshot now;
+
+    // All fields are taken from the same moment.
+    getTimeSnapshot (&now);
 
     for (i = 0; format[i] != 0; i++) {
         switch (format[i]) {
         case 'd':
         case 'D':
-            v = getUptimeDays();
+            v = now.days;
             j = 1;
 
-            if (format[i + 1] == 'D') {
+            while (format[i + 1] == 'D' && j < 5) {
                 j++;
                 i++;
             }
@@ -233,7 +541,7 @@ void uptimeToString (unsigned char* strBuff, const unsigned char* format)
 
         case 'h':
         case 'H':
-            v = getUptimeHours();
+            v = now.hours;
             j = 1;
 
             if (format[i + 1] == 'H') {
@@ -245,7 +553,7 @@ void uptimeToString (unsigned char* strBuff, const unsigned char* format)
 
         case 'm':
         case 'M':
-            v = getUptimeMinutes();
+            v = now.minutes;
             j = 1;
 
             if (format[i + 1] == 'M') {
@@ -257,7 +565,7 @@ void uptimeToString (unsigned char* strBuff, const unsigned char* format)
 
         case 's':
         case 'S':
-            v = getUptimeSeconds();
+            v = now.seconds;
             j = 1;
 
             if (format[i + 1] == 'S') {
@@ -268,7 +576,7 @@ void uptimeToString (unsigned char* strBuff, const unsigned char* format)
             break;
 
         case 't':
-            v = getFTimerMinutes();
+            v = now.fTimerMinutes;
             j = 1;
 
             if (format[i + 1] == 't') {
@@ -279,7 +587,7 @@ void uptimeToString (unsigned char* strBuff, const unsigned char* format)
             break;
 
         case 'T':
-            v = getFTimerHours();
+            v = now.fTimerHours;
             j = 1;
 
             if (format[i + 1] == 'T') {
@@ -311,62 +619,78 @@ void uptimeToString (unsigned char* strBuff, const unsigned char* format)
 }
 
 /**
- * @brief This function is timer's interrupt request handler
- * so keep it small and fast as much as possible.
+ * @brief Counts one more second of uptime and runs the fermentation timer.
  */
-void TIM4_UPD_handler() __interrupt (23)
+static void nextSecond()
 {
-    TIM4_SR &= ~TIM_SR1_UIF; // Reset flag
+    seconds++;
+    correctionSum += correction;
+    secondLength = TICKS_IN_SECOND + correctionSum / TICK_PPM;
+    correctionSum %= TICK_PPM;
 
-    if ( ( (unsigned int) (uptime & BITMASK (BITS_FOR_TICKS) ) ) >= TICKS_IN_SECOND) {
-        uptime &= NBITMASK (SECONDS_FIRST_BIT);
-        uptime += (unsigned long) 1 << SECONDS_FIRST_BIT;
+    // Carry into minutes, hours and days.
+    if (++uptimeSeconds == 60) {
+        uptimeSeconds = 0;
 
-        // Increment minutes count when 60 seconds have passed.
-        if ( ( (unsigned char) (uptime >> SECONDS_FIRST_BIT) & BITMASK (BITS_FOR_SECONDS) ) == 60) {
-            uptime &= NBITMASK (MINUTES_FIRST_BIT);
-            uptime += (unsigned long) 1 << MINUTES_FIRST_BIT;
-        }
+        if (++uptimeMinutes == 60) {
+            uptimeMinutes = 0;
 
-        // Increment hours count when 60 minutes have passed.
-        if ( ( (unsigned char) (uptime >> MINUTES_FIRST_BIT) & BITMASK (BITS_FOR_MINUTES) ) == 60) {
-            uptime &= NBITMASK (HOURS_FIRST_BIT);
-            uptime += (unsigned long) 1 << HOURS_FIRST_BIT;
+            if (++uptimeHours == 24) {
+                uptimeHours = 0;
+                uptimeDays++;
+            }
         }
+    }
 
-        // Increment days count when 24 hours have passed.
-        if ( ( (unsigned char) (uptime >> HOURS_FIRST_BIT) & BITMASK (BITS_FOR_HOURS) ) == 24) {
-            uptime &= NBITMASK (DAYS_FIRST_BIT);
-            uptime += (unsigned long) 1 << DAYS_FIRST_BIT;
-        }
+    // Count the fermentation time down.
+    if (fTimer && fTimerRemaining != 0 && !fTimerPaused
+            && getSensorFault() == ADC_SENSOR_OK) {
+        fTimerRemaining--;
+
+        if (fTimerSeconds-- == 0) {
+            fTimerSeconds = 59;
 
-        // Decrement fermentation timer value.
-        if (isFTimer() && fTimerSeconds == getUptimeSeconds() ) {
-            if (getFTimerMinutes() > 0) {
-                fTimer--;
-
-                // Disable the relay functionality when the fermentation timer is exhausted.
-                if (fTimer == 0) {
-                    enableRelay (false);
-                }
-            } else {
-                fTimer = ( (getFTimerHours() - 1) << BITS_FOR_MINUTES) + 59;
+            if (fTimerMinutes-- == 0) {
+                fTimerMinutes = 59;
+                fTimerHours--;
             }
         }
     }
+}
 
-    uptime++;
+/**
+ * @brief Adds time which has passed while the timer was stopped (in
+ *  active-halt mode) to the uptime. Called from an interrupt handler only.
+ * @param val
+ *  amount of ticks to be added.
+ */
+void advanceUptime (unsigned int val)
+{
+    ticks += val;
 
-    // Try not to call all refresh functions at once.
-    buzzRelay ();
+    while (ticks >= secondLength) {
+        ticks -= secondLength;
+        nextSecond();
+    }
 
-    if ( ( (unsigned char) getUptimeTicks() & 0x0F) == 1) {
-        refreshMenu();
-    } else if ( ( (unsigned char) getUptimeTicks() & 0xFF) == 2) {
-        startADC();
-    } else if ( ( (unsigned char) getUptimeTicks() & 0xFF) == 3) {
-        refreshRelay();
+    timeSeq++;
+}
+
+/**
+ * @brief This function is timer's interrupt request handler
+ * so keep it small and fast as much as possible.
+ */
+void TIM4_UPD_handler() __interrupt (23)
+{
+    TIM4_SR &= ~TIM_SR1_UIF; // Reset flag
+
+    if (++ticks >= secondLength) {
+        ticks = 0;
+        nextSecond();
     }
 
+    timeSeq++;
+    buzzRelay ();
+    runTasks();
     refreshDisplay();
 }
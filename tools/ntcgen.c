@@ -0,0 +1,355 @@
+/*
+ * This file is part of the firmware for yogurt maker project
+ * (https://github.com/mister-grumbler/yogurt-maker).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Host-side generator of the NTC conversion tables used by adc.c.
+ *
+ * The thermistor is connected between the ADC input and ground, with a
+ * pull-up resistor to the ADC reference. The thermistor is described either
+ * by the beta model (-r R25 -b BETA) or by the Steinhart-Hart coefficients
+ * (-A A -B B -C C). The generated header is written to stdout and contains:
+ *  - rawAdc[] - raw 10-bit ADC values from -l to -h with the step -s,
+ *    used for the reverse conversion (temperature -> raw);
+ *  - adcSegmentBase[] / adcSegmentSlope[] - piecewise linear segments over
+ *    the 12-bit decimated ADC value. Segments are 2^w counts wide, and
+ *    2^n counts wide within the optional fine band (-f LOW HIGH in C).
+ *
+ * Build: cc -o ntcgen ntcgen.c -lm
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define KELVIN          273.15
+#define RAW_FULL_SCALE  1024.0  // Full scale of the 10-bit ADC
+#define SEG_FULL_SCALE  4096    // Full scale of the 12-bit decimated value
+#define FINE_SCALE      160.0   // Units of adcSegmentBase[] per degree (1/16 of 0.1 C)
+#define MAX_SEGMENTS    256
+
+static double r25 = 10000.0;
+static double beta = 3132.0;
+static double shA, shB, shC;
+static int steinhart;
+static double pullUp = 20000.0;
+static double tMin = -52.0;
+static double tMax = 112.0;
+static int step = 10;
+static double bandLow, bandHigh;
+static int band;
+static int segmentBits = 6;
+static int bandBits = 4;
+
+/**
+ * @brief Thermistor temperature for the given resistance.
+ * @param r resistance in ohms.
+ * @return temperature in degrees of Celsius.
+ */
+static double tempOfResistance (double r)
+{
+    double l = log (r);
+
+    if (steinhart) {
+        return 1.0 / (shA + shB * l + shC * l * l * l) - KELVIN;
+    }
+
+    return 1.0 / (1.0 / (25.0 + KELVIN) + log (r / r25) / beta) - KELVIN;
+}
+
+/**
+ * @brief Thermistor resistance for the given temperature.
+ *  The Steinhart-Hart equation is inverted by bisection of ln(R).
+ * @param t temperature in degrees of Celsius.
+ * @return resistance in ohms.
+ */
+static double resistanceOfTemp (double t)
+{
+    double lo = log (1.0), hi = log (1.0e8), mid;
+    int i;
+
+    if (!steinhart) {
+        return r25 * exp (beta * (1.0 / (t + KELVIN) - 1.0 / (25.0 + KELVIN) ) );
+    }
+
+    for (i = 0; i < 100; i++) {
+        mid = (lo + hi) / 2;
+
+        // Resistance decreases while temperature grows.
+        if (tempOfResistance (exp (mid) ) > t) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return exp (mid);
+}
+
+/**
+ * @brief Temperature for the 12-bit decimated ADC value, clamped to the
+ *  range of the table.
+ * @param val ADC value in 1/4 of 10-bit counts.
+ * @return temperature in degrees of Celsius.
+ */
+static double tempOfValue (double val)
+{
+    double t;
+
+    if (val <= 0) {
+        return tMax;
+    }
+
+    t = tempOfResistance (pullUp * val / (SEG_FULL_SCALE - val) );
+
+    if (t > tMax) {
+        return tMax;
+    }
+
+    if (t < tMin) {
+        return tMin;
+    }
+
+    return t;
+}
+
+/**
+ * @brief 12-bit value for the given temperature, rounded down to the
+ *  width of a coarse segment.
+ */
+static int alignedValueOfTemp (double t)
+{
+    double r = resistanceOfTemp (t);
+    int val = (int) (SEG_FULL_SCALE * r / (r + pullUp) );
+
+    return val & ~ ( (1 << segmentBits) - 1);
+}
+
+static void usage (const char* name)
+{
+    fprintf (stderr, "Usage: %s [-r R25 -b BETA | -A A -B B -C C] [-p PULLUP]\n"
+             "  [-l TMIN] [-h TMAX] [-s STEP] [-f LOW HIGH] [-w BITS] [-n BITS]\n"
+             "  -s   step of rawAdc[] in tenths of degree\n"
+             "  -f   fine band in degrees (LOW and HIGH as two arguments)\n"
+             "  -w   width of coarse segments, bits of the 12-bit value\n"
+             "  -n   width of segments within the fine band, bits\n", name);
+    exit (1);
+}
+
+int main (int argc, char** argv)
+{
+    int start[MAX_SEGMENTS], width[MAX_SEGMENTS];
+    long base[MAX_SEGMENTS];
+    double drop[MAX_SEGMENTS];
+    unsigned long slope[MAX_SEGMENTS];
+    int bandStart = SEG_FULL_SCALE, bandEnd = SEG_FULL_SCALE;
+    int bandFirst = 0, bandAfter = 0;
+    int count = 0, size, val, opt, i, q;
+    double maxError = 0, bandError = 0;
+
+    while ( (opt = getopt (argc, argv, "r:b:A:B:C:p:l:h:s:f:w:n:") ) != -1) {
+        switch (opt) {
+        case 'r':
+            r25 = atof (optarg);
+            break;
+
+        case 'b':
+            beta = atof (optarg);
+            break;
+
+        case 'A':
+            shA = atof (optarg);
+            steinhart = 1;
+            break;
+
+        case 'B':
+            shB = atof (optarg);
+            break;
+
+        case 'C':
+            shC = atof (optarg);
+            break;
+
+        case 'p':
+            pullUp = atof (optarg);
+            break;
+
+        case 'l':
+            tMin = atof (optarg);
+            break;
+
+        case 'h':
+            tMax = atof (optarg);
+            break;
+
+        case 's':
+            step = atoi (optarg);
+            break;
+
+        case 'f':
+            if (optind >= argc) {
+                usage (argv[0]);
+            }
+
+            bandLow = atof (optarg);
+            bandHigh = atof (argv[optind++]);
+            band = 1;
+            break;
+
+        case 'w':
+            segmentBits = atoi (optarg);
+            break;
+
+        case 'n':
+            bandBits = atoi (optarg);
+            break;
+
+        default:
+            usage (argv[0]);
+        }
+    }
+
+    if (step <= 0 || tMax <= tMin || segmentBits < 2 || segmentBits > 8
+            || bandBits < 2 || bandBits > segmentBits) {
+        usage (argv[0]);
+    }
+
+    // Higher temperature gives lower ADC value.
+    if (band) {
+        bandStart = alignedValueOfTemp (bandHigh);
+        bandEnd = alignedValueOfTemp (bandLow) + (1 << segmentBits);
+    }
+
+    // Split the range of the 12-bit value into segments.
+    for (val = 0; val < SEG_FULL_SCALE; count++) {
+        if (count >= MAX_SEGMENTS) {
+            fprintf (stderr, "Too many segments\n");
+            return 1;
+        }
+
+        if (val == bandStart) {
+            bandFirst = count;
+        }
+
+        if (val == bandEnd) {
+            bandAfter = count;
+        }
+
+        start[count] = val;
+        width[count] = (val >= bandStart && val < bandEnd) ? 1 << bandBits : 1 << segmentBits;
+        val += width[count];
+    }
+
+    if (!band) {
+        bandFirst = bandAfter = count;
+    }
+
+    for (i = 0; i < count; i++) {
+        double t0 = tempOfValue (start[i]);
+        double t1 = tempOfValue (start[i] + width[i]);
+
+        base[i] = lround (t0 * FINE_SCALE);
+        drop[i] = (t0 - t1) * FINE_SCALE / width[i];
+    }
+
+    // Largest Q format of the slope which keeps offset * slope in 16 bits.
+    for (q = 8; q > 0; q--) {
+        for (i = 0; i < count; i++) {
+            if ( (width[i] - 1) * lround (drop[i] * (1 << q) ) > 0xFFFF) {
+                break;
+            }
+        }
+
+        if (i == count) {
+            break;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        slope[i] = lround (drop[i] * (1 << q) );
+    }
+
+    // Approximation error against the model, in degrees.
+    for (i = 0; i < count; i++) {
+        int o;
+
+        for (o = 0; o < width[i]; o++) {
+            double approx = (base[i] - (long) ( (o * slope[i]) >> q) ) / FINE_SCALE;
+            double err = fabs (approx - tempOfValue (start[i] + o) );
+
+            if (err > maxError) {
+                maxError = err;
+            }
+
+            if (start[i] >= bandStart && start[i] < bandEnd && err > bandError) {
+                bandError = err;
+            }
+        }
+    }
+
+    printf ("/*\n * Generated by tools/ntcgen.c, do not edit.\n");
+
+    if (steinhart) {
+        printf (" * Steinhart-Hart: A=%g B=%g C=%g", shA, shB, shC);
+    } else {
+        printf (" * Beta model: R25=%g B=%g", r25, beta);
+    }
+
+    printf (", pull-up %g.\n", pullUp);
+    printf (" * Segments: %d, max error %.2f C", count, maxError);
+
+    if (band) {
+        printf (", within %g..%g C %.2f C", bandLow, bandHigh, bandError);
+    }
+
+    printf (".\n */\n\n#ifndef NTC_TABLE_H\n#define NTC_TABLE_H\n\n");
+    size = (int) ( (tMax - tMin) * 10 / step) + 1;
+    printf ("#define ADC_RAW_TABLE_BASE_TEMP %d\n", (int) lround (tMin * 10) );
+    printf ("#define ADC_RAW_TABLE_STEP      %d\n", step);
+    printf ("#define ADC_SEGMENT_BITS        %d\n", segmentBits);
+    printf ("#define ADC_BAND_BITS           %d\n", bandBits);
+    printf ("#define ADC_BAND_START          %d\n", bandStart);
+    printf ("#define ADC_BAND_END            %d\n", bandEnd);
+    printf ("#define ADC_BAND_FIRST          %d\n", bandFirst);
+    printf ("#define ADC_BAND_AFTER          %d\n", bandAfter);
+    printf ("#define ADC_SLOPE_BITS          %d\n\n", q);
+
+    printf ("const unsigned int rawAdc[] = {");
+
+    for (i = 0; i < size; i++) {
+        double r = resistanceOfTemp (tMin + i * step / 10.0);
+
+        printf ("%s%ld", i % 10 ? ", " : (i ? ",\n    " : "\n    "),
+                lround (RAW_FULL_SCALE * r / (r + pullUp) ) );
+    }
+
+    printf ("\n};\n\nconst int adcSegmentBase[] = {");
+
+    for (i = 0; i < count; i++) {
+        printf ("%s%ld", i % 8 ? ", " : (i ? ",\n    " : "\n    "), base[i]);
+    }
+
+    printf ("\n};\n\nconst unsigned int adcSegmentSlope[] = {");
+
+    for (i = 0; i < count; i++) {
+        printf ("%s%lu", i % 8 ? ", " : (i ? ",\n    " : "\n    "), slope[i]);
+    }
+
+    printf ("\n};\n\n#endif\n");
+
+    return 0;
+}
@@ -17,9 +17,15 @@
 
 #include "adc.h"
 #include "buttons.h"
+#include "calibration.h"
+#include "checkpoint.h"
 #include "display.h"
+#include "events.h"
 #include "menu.h"
 #include "params.h"
+#include "pid.h"
+#include "power.h"
+#include "profile.h"
 #include "relay.h"
 #include "timer.h"
 
@@ -50,6 +56,72 @@ void strConcat(unsigned char * from, unsigned char * to)
     to[s + i] = 0; /* Устанавливаем завершающий нуль-символ */
 }
 
+/**
+ * @brief Формирование строки пункта меню диагностики
+ * @param item Номер пункта (MENU_DIAG_...)
+ * @param value false - обозначение пункта, true - его значение
+ * @param str Буфер для строки
+ *
+ * Пункты: L - запаздывание модели нагрева (с), T - постоянная времени
+ * (мин), H - прирост температуры при полной мощности (градусы),
+ * C - число включений реле, ON - время работы реле (ч), R - самое
+ * долгое включение (мин). Значения больше 999 показываются в тысячах
+ * с одним знаком после точки.
+ */
+void diagnosticToString(unsigned char item, bool value, unsigned char * str)
+{
+    static const char * const labels[] = {"L", "T", "H", "C", "ON", "R"};
+    unsigned long val;
+    unsigned char i;
+
+    if (!value) {
+        for (i = 0; labels[item][i] != 0; i++) {
+            str[i] = labels[item][i];
+        }
+        str[i] = 0;
+        return;
+    }
+
+    switch (item) {
+    case MENU_DIAG_DEAD_TIME:
+        val = getModelDeadTime();
+        break;
+
+    case MENU_DIAG_TIME_CONSTANT:
+        val = getModelTimeConstant() / 60;
+        break;
+
+    case MENU_DIAG_GAIN:
+        val = getModelGain();
+        break;
+
+    case MENU_DIAG_CYCLES:
+        val = getRelayCycles();
+        break;
+
+    case MENU_DIAG_ON_TIME:
+        val = getRelayOnTime() / 3600;
+        break;
+
+    default:
+        val = getRelayLongestRun() / 60;
+    }
+
+    /* Дисплей показывает не более трех цифр */
+    if (val > 999) {
+        val /= 100;
+
+        if (val > 999) {
+            val = 999;
+        }
+
+        itofpa(val, str, 0);
+        return;
+    }
+
+    itofpa(val, str, 6);
+}
+
 /**
  * @brief Главная функция программы
  * @return Технически никогда не возвращает значение (бесконечный цикл)
@@ -60,56 +132,98 @@ int main(void)
     static unsigned char* stringBuffer[7];  /* Буфер для строковых данных */
     static unsigned char* timerBuffer[5];   /* Буфер для времени */
     unsigned char paramMsg[] = {'P', '0', 0}; /* Шаблон сообщения параметра */
+    unsigned char errorMsg[] = {'E', '0', '0', 0}; /* Шаблон кода ошибки датчика */
+    unsigned char autotuneMsg[] = {'A', 'T', '0', 0}; /* Шаблон хода автонастройки */
+    unsigned char stepMsg[] = {'S', '1', 0};   /* Шаблон шага профиля */
+    unsigned int remaining;                 /* Остаток выдержки шага, минуты */
+    TimeSnapshot now;                       /* Согласованная копия времени */
 
     /* Инициализация всех модулей системы */
+    initPower();           /* Тактовая частота и режим пониженного потребления */
     initMenu();            /* Меню */
     initButtons();         /* Кнопки */
     initParamsEEPROM();    /* Параметры в EEPROM */
     initDisplay();         /* Дисплей */
     initADC();             /* АЦП и датчик температуры */
     initRelay();           /* Управление реле */
+    initProfile();         /* Программа ферментации в EEPROM */
+    initEvents();          /* Очередь отложенных событий */
     initTimer();           /* Таймеры системы */
+    initCheckpoint();      /* Продолжение прерванной партии после сбоя питания */
 
     INTERRUPT_ENABLE;      /* Разрешаем обработку прерываний */
 
     /* Основной бесконечный цикл программы */
     while (true) {
+        /* Обработка событий, поставленных прерываниями (меню, реле, EEPROM) */
+        runEvents();
+        refreshCheckpoint(); /* Сохранение состояния партии в EEPROM */
+        refreshRecord();     /* Запись очередного байта записи в EEPROM */
+        getTimeSnapshot(&now);
+
         /* Отключаем тестовый режим дисплея после первой секунды работы */
-        if (getUptimeSeconds() > 0) {
+        if (now.uptime > 0) {
             setDisplayTestMode(false, "");
         }
 
         /* Обработка текущего состояния меню */
         if (getMenuDisplay() == MENU_ROOT) {
             /* В основном меню попеременно показываем температуру и таймер */
-            if (isRelayEnabled() && getUptimeSeconds() & 0x08) {
+            if (getCalibrationState() == CALIBRATION_READY) {
+                /* Калибровка: ожидание отметки начала интервала */
+                setDisplayStr("CAL");
+            } else if (getCalibrationState() == CALIBRATION_RUNNING) {
+                /* Калибровка: идет отсчет эталонного интервала */
+                setDisplayStr("C.A.L.");
+            } else if (getSensorFault() != ADC_SENSOR_OK) {
+                /* Ошибка датчика: E01 - обрыв, E02 - замыкание, E03 - скачок */
+                errorMsg[2] = '0' + getSensorFault();
+                setDisplayStr((unsigned char*)&errorMsg);
+            } else if (isRelayEnabled() && now.seconds & 0x08) {
                 stringBuffer[0] = 0; /* Очищаем буфер */
 
-                if (isFTimer()) {
-                    /* Мигаем точкой между часами и минутами */
-                    if ((getUptimeTicks() & 0x100)) {
+                if (getParamById(PARAM_CONTROL_MODE) == CONTROL_MODE_AUTOTUNE) {
+                    /* Автонастройка ПИД: AT и число пройденных циклов */
+                    autotuneMsg[2] = '0' + getAutotuneCycle();
+                    setDisplayStr((unsigned char*)&autotuneMsg);
+                } else if (isProfile()) {
+                    /* Профиль: попеременно номер шага и остаток выдержки */
+                    remaining = getProfileRemaining();
+
+                    if (now.seconds & 0x04) {
+                        stepMsg[1] = '1' + getProfileStep();
+                        setDisplayStr((unsigned char*)&stepMsg);
+                    } else if (remaining == PROFILE_NOT_SOAKING) {
+                        setDisplayStr("---"); /* Выход на температуру шага */
+                    } else {
+                        /* Часы и минуты в виде h.mm, от 10 часов только часы */
+                        holdToString(remaining, (unsigned char*)stringBuffer);
+                        setDisplayStr((char*)stringBuffer);
+                    }
+                } else if (isFTimer()) {
+                    /* Мигаем точкой между часами и минутами, на паузе точка горит */
+                    if ((now.ticks & 0x100) && !isFTimerPaused()) {
                         uptimeToString((unsigned char*)stringBuffer, "Ttt");
                     } else {
                         uptimeToString((unsigned char*)stringBuffer, "T.tt");
                     }
+
+                    setDisplayStr((char*)stringBuffer);
                 } else {
                     /* Если таймер не активен - показываем "No Timer Running" */
                     setDisplayStr("N.T.R.");
-                    continue; /* Переходим к следующей итерации */
                 }
-
-                setDisplayStr((char*)stringBuffer);
             } else {
                 /* Показываем текущую температуру */
                 int temp = getTemperature();
                 itofpa(temp, (char*)stringBuffer, 0);
                 setDisplayStr((char*)stringBuffer);
 
-                /* Проверка и индикация граничных значений температуры */
+                /* Индикация срабатывания аналогового сторожевого таймера */
                 if (getParamById(PARAM_OVERHEAT_INDICATION)) {
-                    if (temp < getParamById(PARAM_MIN_TEMPERATURE)) {
+                    if (getAdcWatchdog() == ADC_WATCHDOG_UNDER) {
                         setDisplayStr("LLL"); /* Температура ниже минимальной */
-                    } else if (temp > getParamById(PARAM_MAX_TEMPERATURE)) {
+                    } else if (getAdcWatchdog() == ADC_WATCHDOG_OVER) {
                         setDisplayStr("HHH"); /* Температура выше максимальной */
                     }
                 }
@@ -121,8 +235,12 @@ int main(void)
             setDisplayStr((char*)stringBuffer);
         } 
         else if (getMenuDisplay() == MENU_SELECT_PARAM) {
-            /* Режим выбора параметра (P0, P1...) */
-            paramMsg[1] = '0' + getParamId();
+            /* Режим выбора параметра (P0 ... P9, PA ... PE) */
+            if (getParamId() < 10) {
+                paramMsg[1] = '0' + getParamId();
+            } else {
+                paramMsg[1] = 'A' + getParamId() - 10;
+            }
             setDisplayStr((unsigned char*)&paramMsg);
         } 
         else if (getMenuDisplay() == MENU_CHANGE_PARAM) {
@@ -130,13 +248,21 @@ int main(void)
             paramToString(getParamId(), (char*)stringBuffer);
             setDisplayStr((char*)stringBuffer);
         } 
+        else if (getMenuDisplay() == MENU_DIAGNOSTIC) {
+            /* Диагностика: попеременно обозначение и значение пункта */
+            diagnosticToString(getDiagnosticItem(), now.seconds & 0x01, (unsigned char*)stringBuffer);
+            setDisplayStr((char*)stringBuffer);
+        }
         else {
             /* Неизвестное состояние меню - показываем ошибку */
             setDisplayStr("ERR");
             /* Мигаем дисплеем при ошибке */
-            setDisplayOff((bool)((unsigned char)getUptimeTicks() & 0x80));
+            setDisplayOff((bool)((unsigned char)now.ticks & 0x80));
         }
 
+        /* Переход в active-halt при бездействии, выход по кнопке */
+        idlePower();
+
         WAIT_FOR_INTERRUPT; /* Ожидаем следующее прерывание */
     };
 }